@@ -2,8 +2,14 @@
 #define LEAPFROG_H
 
 #include "common.h"
-#include <tpie/btree.h>
+#include "lf_relation.h"
+#include "lf_intersect.h"
+#include "lf_stats.h"
+#include "lf_cache.h"
+#include "lf_factorized.h"
 #include <tpie/file_stream.h>
+#include <tpie/job.h>
+#include <tpie/tpie_assert.h>
 #include <iostream>
 #include <cstdint>
 #include <cstdarg>
@@ -11,58 +17,179 @@
 #include <string>
 #include <algorithm>
 #include <memory>
-using std::uint8_t;
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <stdexcept>
 
-typedef std::uint8_t lf_key_size_type;
+/* the depth of every column of a relation with N columns */
+template <size_t N>
+using lf_key_info = std::array<lf_key_size_type, N>;
 
-struct lf_key_comparator {
-    bool operator()(const value_type &l, const value_type &r) const noexcept {
-        return (l.key1 < r.key1) ||
-            (l.key1 == r.key1 && l.key2 < r.key2);
+/* allocates cache-line-aligned arrays */
+template <typename T>
+struct lf_aligned_allocator {
+    typedef T value_type;
+    static constexpr size_t alignment = 64;
+
+    lf_aligned_allocator() {}
+    template <typename U>
+    lf_aligned_allocator(const lf_aligned_allocator<U> &) {}
+
+    T *allocate(size_t n) {
+        void *p;
+        if (posix_memalign(&p, alignment, n * sizeof(T))) throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t) {
+        free(p);
+    }
+
+    template <typename U>
+    bool operator==(const lf_aligned_allocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const lf_aligned_allocator<U> &) const { return false; }
+};
+
+/* a result of a join with N variables, in depth order */
+template <size_t N>
+using lf_tuple = std::array<attr_type, N>;
+
+/* receives the results of a join in batches, each result being the keys
+ * of depth 1 to the last depth. Parallel joins call write() from several
+ * threads at once. */
+struct lf_output {
+    virtual ~lf_output() {}
+
+    /* @param tuples ntuples * width keys, one result after another */
+    virtual void write(const attr_type *tuples, size_t ntuples, size_t width) = 0;
+};
+
+/* calls f(const attr_type *tuple, size_t width) on every result, one at a time */
+template <typename F>
+struct lf_visitor_output: public lf_output {
+    F m_f;
+    std::mutex m_mutex;
+
+    lf_visitor_output(F f): m_f(std::move(f)) {}
+
+    virtual void write(const attr_type *tuples, size_t ntuples, size_t width) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < ntuples; ++i) {
+            m_f(tuples + i * width, width);
+        }
+    }
+};
+
+/* writes the results of a join with N variables to a file_stream */
+template <size_t N>
+struct lf_file_stream_output: public lf_output {
+    tpie::file_stream<lf_tuple<N>> &m_out;
+    std::mutex m_mutex;
+
+    lf_file_stream_output(tpie::file_stream<lf_tuple<N>> &out): m_out(out) {}
+
+    /* rows of another width than N, e.g. of a projected join, are an error */
+    virtual void write(const attr_type *tuples, size_t ntuples, size_t width) override {
+        if (width != N) throw std::invalid_argument("tuple width does not match the number of variables");
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const lf_tuple<N> *begin = reinterpret_cast<const lf_tuple<N> *>(tuples);
+        m_out.write(begin, begin + ntuples);
     }
 };
 
-struct lf_key_info {
-    lf_key_size_type key1_depth,
-                     key2_depth;
+/* Stops the joins it is given to from another thread, or once a time or
+ * seek budget runs out. The joins poll it every few thousand steps and
+ * stop with the results found so far. */
+struct lf_cancel_token {
+    typedef std::chrono::steady_clock clock;
+
+    std::atomic<bool> m_cancelled;
+    std::atomic<uint64_t> m_seeks;
+    /* 0 for no seek budget */
+    uint64_t m_max_seeks;
+    clock::time_point m_deadline;
+
+    lf_cancel_token()
+        : m_cancelled(false), m_seeks(0), m_max_seeks(0),
+          m_deadline(clock::time_point::max()) {}
+
+    void cancel() {
+        m_cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool cancelled() const {
+        return m_cancelled.load(std::memory_order_relaxed);
+    }
+
+    /* cancels the joins still running after d from now */
+    void set_time_budget(clock::duration d) {
+        m_deadline = clock::now() + d;
+    }
+
+    /* cancels the joins once they have done about n seeks in total */
+    void set_seek_budget(uint64_t n) {
+        m_max_seeks = n;
+    }
+
+    /* adds the seeks done since the last poll and checks the budgets
+     * @returns whether the join must stop */
+    bool poll(uint64_t seeks) {
+        uint64_t total = m_seeks.fetch_add(seeks, std::memory_order_relaxed) + seeks;
+        if ((m_max_seeks && total >= m_max_seeks) || clock::now() >= m_deadline) {
+            cancel();
+        }
+        return cancelled();
+    }
 };
 
+/* T... are the tpie::btree options of the relations, optionally preceded by
+ * lf_arity<N> for relations with N columns, or lf_flat_trie to store binary
+ * relations as lf_trie_relations */
 template<typename ...T>
 struct lf_join {
-    typedef tpie::btree<value_type, tpie::btree_comp<lf_key_comparator>, T...> btree_type;
+    typedef typename lf_relation_of<T...>::type relation_type;
+    typedef typename relation_type::cursor cursor_type;
+    typedef typename relation_type::mark mark_type;
+    typedef typename relation_type::tuple_type tuple_type;
+    static constexpr size_t arity = relation_type::arity;
+    typedef lf_key_info<arity> key_info_type;
     
-    struct lf_iter_ref {
-        typename btree_type::iterator m_iter;
-    };
-
+    /* one iterator of the leapfrog at some depth. The iterators of a table
+     * share its cursor, which the iterator of the first variable column
+     * positions for the others. */
     struct lf_iter_info {
         lf_key_size_type m_table_id,
                          m_key_id;
-        std::shared_ptr<lf_iter_ref> m_iter_ref;
-        btree_type *m_btree;
-        lf_iter_info *m_next_iter_info, *m_prev_iter_info;
-        value_type m_base_value;
+        cursor_type *m_iter;
+        /* where open() found the shared cursor, and the row there */
+        mark_type m_open_mark;
+        tuple_type m_open_value;
+        /* where the keys of the table start if this iterator is the first
+         * variable column of its table, nullptr otherwise */
+        const cursor_type *m_start;
+        const relation_type *m_rel;
+        tuple_type m_base_value;
+        attr_type m_end_key;
         
-        lf_iter_info(lf_key_size_type table_id, 
-                lf_key_size_type key_id,
-                typename btree_type::iterator iter,
-                btree_type *btree):
-            lf_iter_info(table_id, key_id, std::shared_ptr<lf_iter_ref>(new lf_iter_ref{iter}), btree) {
-            
-        }
-
         lf_iter_info(lf_key_size_type table_id,
                     lf_key_size_type key_id,
-                    std::shared_ptr<lf_iter_ref> iter_ref,
-                    btree_type *btree)
+                    cursor_type *iter,
+                    const cursor_type *start,
+                    const relation_type *rel)
             : m_table_id(table_id), m_key_id(key_id),
-              m_iter_ref(iter_ref), m_btree(btree),
-              m_base_value{iter_ref->m_iter->key1, iter_ref->m_iter->key2},
-              m_next_iter_info(nullptr), m_prev_iter_info(nullptr) {}
+              m_iter(iter), m_start(start), m_rel(rel),
+              m_base_value(rel->at_end(*iter) ? tuple_type() : rel->get(*iter)),
+              m_end_key(~(attr_type) 0) {}
 
 
-        int key() const noexcept {
-            return reinterpret_cast<const attr_type *>(&*(m_iter_ref->m_iter))[m_key_id];
+        attr_type key() const noexcept {
+            return m_rel->key(*m_iter, m_key_id);
         }
 
         void next() {
@@ -70,221 +197,1207 @@ struct lf_join {
         }
 
         bool atEnd() const noexcept {
-            if (m_iter_ref->m_iter == m_btree->end()) return true;
+            if (m_rel->at_end(*m_iter)) return true;
             for (lf_key_size_type i = 0; i < m_key_id; ++i) {
-                if (reinterpret_cast<const attr_type *>(&*(m_iter_ref->m_iter))[i] != 
-                    reinterpret_cast<const attr_type *>(&m_base_value)[i]) return true;
+                if (m_rel->key(*m_iter, i) != lf_key(m_base_value, i)) return true;
             }
-            return false;
+            return key() >= m_end_key;
+        }
+
+        /* sets n to the number of keys left under the current prefix
+         * @returns false if they cannot be counted without visiting them */
+        bool count_keys(size_t &n) const {
+            if (m_end_key != ~(attr_type) 0) return false;
+            return m_rel->count_keys(*m_iter, m_base_value, m_key_id, n);
+        }
+
+        /* the keys left under the current prefix and below m_end_key
+         * @returns false if they are not stored contiguously */
+        bool key_run(lf_run &run) const {
+            if (!m_rel->key_run(*m_iter, m_key_id, run)) return false;
+            if (m_end_key != ~(attr_type) 0) {
+                run.m_end = std::lower_bound(run.m_begin, run.m_end, m_end_key);
+            }
+            return true;
+        }
+
+        /* @returns the last key under the current prefix */
+        attr_type last_key() const {
+            return m_rel->last_key(*m_iter, m_base_value, m_key_id);
         }
 
         void seek(attr_type key) {
-            reinterpret_cast<attr_type *>(&m_base_value)[m_key_id] = key;
-            for (lf_key_size_type i = m_key_id + 1; i < 2; ++i) {
-                reinterpret_cast<attr_type *>(&m_base_value)[i] = 0;
+            lf_key(m_base_value, m_key_id) = key;
+            for (size_t i = m_key_id + 1; i < arity; ++i) {
+                lf_key(m_base_value, i) = 0;
             }
-            m_iter_ref->m_iter = m_btree->lower_bound(m_base_value);
+            m_rel->lower_bound_from(*m_iter, m_base_value);
         }
 
         void open() {
-            if (!m_prev_iter_info) {
-                m_iter_ref->m_iter = m_btree->begin();
+            if (m_start) {
+                *m_iter = *m_start;
+            } else {
+                m_open_mark = m_rel->get_mark(*m_iter);
             }
-            m_base_value = *(m_iter_ref->m_iter);
+            m_base_value = m_rel->get(*m_iter);
+            m_open_value = m_base_value;
         }
 
+        /* seeks only move forward, so put the shared iterator back where the
+         * parent left it, which searches for the prefix again only if the
+         * cursor has left the block it was in */
         void up() {
-            /*if (m_prev_iter_info) {
-                m_prev_iter_info->seek(
-                    reinterpret_cast<attr_type *>(&m_prev_iter_info->m_base_value)[m_key_id - 1] + 1);
-                m_prev_iter_info->m_at_first = true;
-            } */
-            if (m_prev_iter_info) {
-                m_prev_iter_info->seek(
-                    reinterpret_cast<attr_type *>(&m_base_value)[m_key_id - 1]);
+            if (!m_start) {
+                m_rel->restore(*m_iter, m_open_mark, m_open_value);
+            }
+            m_end_key = ~(attr_type) 0;
+        }
+    };
+
+    static constexpr bool is_internal = relation_type::is_internal;
+
+    /* the iterators of one depth, a slice of the arena of an lf_state */
+    struct lf_depth {
+        lf_iter_info *m_begin, *m_end;
+
+        lf_iter_info *begin() const { return m_begin; }
+        lf_iter_info *end() const { return m_end; }
+        size_t size() const { return m_end - m_begin; }
+        bool empty() const { return m_begin == m_end; }
+        lf_iter_info &operator[](size_t i) const { return m_begin[i]; }
+    };
+
+    /* shared by the states of one run */
+    struct lf_run_control {
+        /* results the limit leaves room for, ~0 for no limit */
+        std::atomic<uint64_t> m_room;
+        std::atomic<bool> m_stopped;
+        lf_cancel_token *m_token;
+
+        lf_run_control(uint64_t limit, lf_cancel_token *token)
+            : m_room(limit ? limit : ~(uint64_t) 0), m_stopped(false), m_token(token) {}
+    };
+
+    /* iterator state of one leapfrog run; every worker owns one of these.
+     * All the iterators live in one cache-line-aligned arena, depth after
+     * depth, and the cursors of the tables in another, so that workers
+     * never share a cache line. A copy gets its own cursors positioned like
+     * the original ones. */
+    struct lf_state {
+        std::vector<cursor_type, lf_aligned_allocator<cursor_type>> m_cursors;
+        std::vector<lf_iter_info, lf_aligned_allocator<lf_iter_info>> m_infos;
+        /* the iterators of depth d are m_infos[m_depth_begin[d]] to
+         * m_infos[m_depth_begin[d + 1] - 1] */
+        std::vector<uint32_t> m_depth_begin;
+        std::vector<uint64_t> m_pos;
+        uint64_t m_count;
+        /* the run ends when this depth is exhausted */
+        lf_key_size_type m_base_depth;
+        /* the last depth of the results if the deeper ones are only checked
+         * for some binding, 0 if all of them are output */
+        lf_key_size_type m_project_depth;
+        /* the last depth of the results if they are counted per binding
+         * of the depths up to it, and m_count when its current binding was
+         * reached */
+        lf_key_size_type m_group_depth;
+        uint64_t m_group_base;
+        lf_run_control *m_control;
+        /* the subtree counts of the worker, nullptr if none are cached, and
+         * m_count when the subtree of every depth was entered, ~0 while its
+         * count is not being recorded */
+        lf_subtree_cache *m_cache;
+        std::vector<uint64_t> m_subtree_base;
+        /* seeks of search() and next(), and their number at the last poll
+         * of the cancel token */
+        uint64_t m_seeks, m_polled_seeks;
+        /* estimated depth-1 keys left when the run stopped early */
+        double m_keys_left;
+        lf_stats_type m_stats;
+        /* results not yet written to m_output */
+        lf_output *m_output;
+        std::vector<attr_type> m_results;
+        /* scratch space of intersect_last() */
+        std::vector<lf_run> m_runs;
+        std::vector<attr_type> m_buffers[2];
+
+        lf_state(): m_count(0), m_base_depth(1), m_project_depth(0),
+            m_group_depth(0), m_group_base(0), m_control(nullptr), m_cache(nullptr),
+            m_seeks(0), m_polled_seeks(0), m_keys_left(0), m_output(nullptr) {}
+
+        lf_state(const lf_state &state)
+            : m_cursors(state.m_cursors), m_infos(state.m_infos),
+              m_depth_begin(state.m_depth_begin), m_pos(state.m_pos),
+              m_count(0), m_base_depth(state.m_base_depth),
+              m_project_depth(state.m_project_depth),
+              m_group_depth(state.m_group_depth), m_group_base(0),
+              m_control(state.m_control), m_cache(state.m_cache),
+              m_subtree_base(state.m_subtree_base.size(), ~(uint64_t) 0),
+              m_seeks(0), m_polled_seeks(0),
+              m_keys_left(0), m_output(state.m_output) {
+            for (auto &info: m_infos) {
+                info.m_iter = &m_cursors[info.m_table_id];
             }
+            m_stats.reset(ndepths(), m_cursors.size());
+        }
+
+        lf_state &operator=(const lf_state &) = delete;
+
+        /* the number of depths plus one, depth 0 being empty */
+        size_t ndepths() const {
+            return m_depth_begin.empty() ? 0 : m_depth_begin.size() - 1;
+        }
+
+        lf_depth depth(size_t d) {
+            return lf_depth{m_infos.data() + m_depth_begin[d],
+                m_infos.data() + m_depth_begin[d + 1]};
         }
     };
 
-    static constexpr bool is_internal =
-        tpie::bbits::tree_state<value_type, 
-            typename tpie::bbits::OptComp<T...>::type>::is_internal;
+    /* work queue shared by the workers of a parallel join. Workers that run
+     * out of work wait here and raise m_hungry, which busy workers poll to
+     * split off part of their remaining keys. The work is done once the
+     * queue is empty and every worker that has started waits here, however
+     * many of the enqueued jobs the pool actually runs, and when. */
+    struct lf_scheduler {
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::vector<std::unique_ptr<lf_state>> m_states;
+        /* the workers that have started */
+        size_t m_nworkers;
+        size_t m_idle;
+        bool m_done;
+        std::atomic<size_t> m_hungry;
+
+        lf_scheduler(): m_nworkers(0), m_idle(0), m_done(false), m_hungry(0) {}
+
+        /* called by a worker before its first pop() */
+        void start() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_nworkers;
+        }
+
+        /* must hold m_mutex */
+        void update_hungry() {
+            m_hungry = (m_idle > m_states.size()) ? m_idle - m_states.size() : 0;
+        }
 
-    std::vector<btree_type> m_btrees;
-    std::vector<lf_key_info> m_keyinfo;
-    std::vector<std::vector<lf_iter_info*>> m_iterinfo;
-    uint64_t m_count;
-    std::vector<uint64_t> m_pos;
+        void push(std::unique_ptr<lf_state> state) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_states.push_back(std::move(state));
+            update_hungry();
+            m_cond.notify_one();
+        }
 
-    auto nrels() { return m_btrees.size(); }
+        /* @returns nullptr when all the work is done */
+        std::unique_ptr<lf_state> pop() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            ++m_idle;
+            while (m_states.empty() && !m_done) {
+                if (m_idle == m_nworkers) {
+                    m_done = true;
+                    m_cond.notify_all();
+                    break;
+                }
+                update_hungry();
+                m_cond.wait(lock);
+            }
+            --m_idle;
+            if (m_done) return nullptr;
+            std::unique_ptr<lf_state> state = std::move(m_states.back());
+            m_states.pop_back();
+            update_hungry();
+            return state;
+        }
+    };
 
-    lf_join() {}
+    struct lf_worker_job: public tpie::job {
+        lf_join *m_join;
+        lf_scheduler *m_sched;
+        lf_subtree_cache m_cache;
+        bool m_cached;
+        uint64_t m_count;
+        double m_keys_left;
+        lf_stats_type m_stats;
 
-    ~lf_join() {
-        for (auto &v: m_iterinfo) {
-            for (auto iterinfo: v) {
-                delete iterinfo;
+        lf_worker_job(lf_join *join, lf_scheduler *sched)
+            : m_join(join), m_sched(sched), m_cached(false), m_count(0), m_keys_left(0) {}
+
+        virtual void operator()() override {
+            m_sched->start();
+            while (std::unique_ptr<lf_state> state = m_sched->pop()) {
+                /* drain the states left once the run is stopped */
+                if (state->m_control->m_stopped.load(std::memory_order_relaxed)) {
+                    m_keys_left += m_join->keys_left(*state);
+                    continue;
+                }
+                state->m_cache = m_cached ? &m_cache : nullptr;
+                m_join->do_join(*state, m_sched);
+                m_count += state->m_count;
+                m_keys_left += state->m_keys_left;
+                m_stats.merge(state->m_stats);
             }
         }
+    };
+
+    /* number of results buffered by a state before they are written */
+    static constexpr size_t output_batch_size = 4096;
+
+    /* number of steps of a state between two polls of the cancel token */
+    static constexpr uint64_t poll_interval = 4096;
+
+    std::vector<relation_type> m_relations;
+    /* the depth of every column, 0 for the columns bound to constants */
+    std::vector<key_info_type> m_keyinfo;
+    /* the constants of every table, in its leading columns */
+    std::vector<tuple_type> m_constants;
+    /* the first row of every table that starts with its constants */
+    std::vector<cursor_type> m_starts;
+    /* see project() and group_by() */
+    lf_key_size_type m_project_depth;
+    lf_key_size_type m_group_depth;
+    /* see limit() and cancel_with() */
+    uint64_t m_limit;
+    lf_cancel_token *m_cancel_token;
+    /* see cache() */
+    size_t m_cache_bytes;
+    /* how the last run ended, see stopped() and progress() */
+    bool m_stopped;
+    double m_progress;
+    lf_stats_type m_stats;
+
+    auto nrels() { return m_relations.size(); }
+
+    /* number of join variables, i.e. the width of a result */
+    size_t nvars() const {
+        size_t n = 0;
+        for (const auto &keyinfo: m_keyinfo) {
+            n = std::max<size_t>(n, *std::max_element(keyinfo.begin(), keyinfo.end()));
+        }
+        return n;
     }
-    
-    /* assuming that the file is sorted */
+
+    /* number of columns of a result, fewer than nvars() when projecting,
+     * and the group depth plus its count when grouping */
+    size_t output_width() const {
+        if (m_group_depth) return m_group_depth + 1;
+        const size_t nvars = this->nvars();
+        return m_project_depth && m_project_depth < nvars ? m_project_depth : nvars;
+    }
+
+    lf_join()
+        : m_project_depth(0), m_group_depth(0), m_limit(0), m_cancel_token(nullptr),
+          m_cache_bytes(0), m_stopped(false), m_progress(1) {}
+
+    /* number of leading columns of a table bound to constants */
+    static lf_key_size_type nconstants(const key_info_type &depths) {
+        lf_key_size_type n = 0;
+        while (n < arity && depths[n] == 0) ++n;
+        return n;
+    }
+
+    /* assuming that the file is sorted and that the depths of the columns
+     * increase. Columns of depth 0 are bound to their value in constants;
+     * they must come first. */
     template <typename X=tpie::bbits::enab>
-    void load_internal_table(tpie::file_stream<value_type> &in,
+    void load_internal_table(tpie::file_stream<tuple_type> &in,
+                    const key_info_type &depths,
+                    const tuple_type &constants = tuple_type(),
+                    tpie::bbits::enable<X, is_internal> = tpie::bbits::enab()) {
+        tp_assert(std::count(depths.begin() + nconstants(depths), depths.end(), 0) == 0,
+                "The constants of a table must be its leading columns");
+        m_relations.emplace_back(in);
+        m_keyinfo.push_back(depths);
+        m_constants.push_back(constants);
+    }
+
+    template <typename X=tpie::bbits::enab>
+    void load_internal_table(tpie::file_stream<tuple_type> &in,
                     lf_key_size_type subject_depth,
                     lf_key_size_type object_depth,
-                    tpie::bbits::enable<X, is_internal> = tpie::bbits::enab()) {
-        
-        tpie::btree_builder<value_type, tpie::btree_comp<lf_key_comparator>,
-            T...> builder;
-        value_type obj;
-        while (in.can_read()) {
-            obj = in.read();
-            builder.push(obj);
-        }
-        m_btrees.emplace_back(builder.build());
-        m_keyinfo.emplace_back(lf_key_info{subject_depth, object_depth});
+                    tpie::bbits::enable<X, is_internal && arity == 2> = tpie::bbits::enab()) {
+        load_internal_table(in, key_info_type{{subject_depth, object_depth}});
     }
     
     template <typename X=tpie::bbits::enab>
-    void load_into_external_table(tpie::file_stream<value_type> &in,
+    void load_into_external_table(tpie::file_stream<tuple_type> &in,
+            const key_info_type &depths,
+            std::string path,
+            const tuple_type &constants = tuple_type(),
+            tpie::bbits::enable<X, !is_internal> = tpie::bbits::enab()) {
+        tp_assert(std::count(depths.begin() + nconstants(depths), depths.end(), 0) == 0,
+                "The constants of a table must be its leading columns");
+        m_relations.emplace_back(in, path);
+        m_keyinfo.push_back(depths);
+        m_constants.push_back(constants);
+    }
+
+    template <typename X=tpie::bbits::enab>
+    void load_into_external_table(tpie::file_stream<tuple_type> &in,
             lf_key_size_type subject_depth,
             lf_key_size_type object_depth,
             std::string path,
-            tpie::bbits::enable<X, !is_internal> = tpie::bbits::enab()) {
-        tpie::btree_builder<value_type, tpie::btree_comp<lf_key_comparator>,
-                T...> builder(path);
-        value_type obj;
-        while (in.can_read()) {
-            obj = in.read();
-            builder.push(obj);
-        }
-        m_btrees.emplace_back(builder.build());
-        m_keyinfo.emplace_back(lf_key_info{subject_depth, object_depth});
+            tpie::bbits::enable<X, !is_internal && arity == 2> = tpie::bbits::enab()) {
+        load_into_external_table(in, key_info_type{{subject_depth, object_depth}}, path);
     }
 
 private:
-    bool prepare_iterinfo() {
-        m_iterinfo.clear();
-        m_iterinfo.resize(1);
-        for (lf_key_size_type table_id = 0; table_id < m_keyinfo.size(); ++table_id) {
-            m_iterinfo[0].emplace_back(new lf_iter_info(table_id, (lf_key_size_type) ~0U,
-                    m_btrees[table_id].begin(), &m_btrees[table_id]));
-            const lf_key_size_type *a_keyinfo = (const lf_key_size_type *) &m_keyinfo[table_id];
-            lf_iter_info *prev_iter_info = nullptr;
-            for (lf_key_size_type i = 0; i < 2; ++i) {
-                if (a_keyinfo[i] >= m_iterinfo.size()) {
-                    m_iterinfo.resize(a_keyinfo[i] + 1);
+    /* Seeks every table to the first row starting with its constants, so
+     * that its iterators only ever see the rows under them.
+     * @returns whether some table has no such row */
+    bool seek_constants() {
+        m_starts.clear();
+        bool empty = false;
+        for (size_t table_id = 0; table_id < m_relations.size(); ++table_id) {
+            const relation_type &rel = m_relations[table_id];
+            const tuple_type &constants = m_constants[table_id];
+            m_starts.push_back(rel.begin());
+            lf_key_size_type n = nconstants(m_keyinfo[table_id]);
+            if (n == 0) continue;
+            cursor_type &start = m_starts.back();
+            rel.lower_bound_from(start, constants);
+            for (lf_key_size_type i = 0; i < n; ++i) {
+                if (rel.at_end(start) || rel.key(start, i) != lf_key(constants, i)) {
+                    empty = true;
+                    break;
+                }
+            }
+        }
+        return empty;
+    }
+
+    /* @returns whether some depth has no iterator */
+    bool prepare_iterinfo(lf_state &state) {
+        state.m_cursors.assign(m_starts.begin(), m_starts.end());
+        state.m_infos.clear();
+        state.m_depth_begin.assign(2, 0);
+        state.m_infos.reserve(m_keyinfo.size() * arity);
+        const size_t nvars = this->nvars();
+        state.m_project_depth = m_project_depth < nvars ? m_project_depth : 0;
+        tp_assert(m_group_depth < nvars, "Cannot group by every depth");
+        tp_assert(!m_group_depth || !m_project_depth, "Cannot both group and project");
+        state.m_group_depth = m_group_depth;
+        for (size_t depth = 1; depth <= nvars; ++depth) {
+            for (lf_key_size_type table_id = 0; table_id < m_keyinfo.size(); ++table_id) {
+                lf_key_size_type first = nconstants(m_keyinfo[table_id]);
+                for (lf_key_size_type i = first; i < arity; ++i) {
+                    if (m_keyinfo[table_id][i] != depth) continue;
+                    state.m_infos.emplace_back(table_id, i, &state.m_cursors[table_id],
+                            i == first ? &m_starts[table_id] : nullptr,
+                            &m_relations[table_id]);
                 }
-                m_iterinfo[a_keyinfo[i]].emplace_back(new lf_iter_info(table_id, i,
-                        m_iterinfo[0][table_id]->m_iter_ref, &m_btrees[table_id]));
-                m_iterinfo[a_keyinfo[i]].back()->m_prev_iter_info = prev_iter_info;
-                if (prev_iter_info)
-                    prev_iter_info->m_next_iter_info = m_iterinfo[a_keyinfo[i]].back();
-                prev_iter_info = m_iterinfo[a_keyinfo[i]].back();
             }
+            state.m_depth_begin.push_back(state.m_infos.size());
         }
+        state.m_stats.reset(state.ndepths(), m_relations.size());
+        state.m_subtree_base.assign(state.ndepths(), ~(uint64_t) 0);
         
-        std::cerr << "total depth = " << m_iterinfo.size() - 1 << std::endl;
-        for (lf_key_size_type depth = 0; depth < m_iterinfo.size(); ++depth) {
-            std::cerr << "depth " << (unsigned) depth << ':';
-            if (m_iterinfo[depth].empty()) return true;
-            for (const auto &iterinfo: m_iterinfo[depth]) {
-                std::cerr << " {" << (unsigned) iterinfo->m_table_id << ", "
-                    << (unsigned) iterinfo->m_key_id << "}";
+        for (size_t depth = 1; depth < state.ndepths(); ++depth) {
+            if (state.depth(depth).empty()) return true;
+        }
+        return false;
+    }
+
+    void print_iterinfo(lf_state &state) const {
+        std::cerr << "total depth = " << state.ndepths() - 1 << std::endl;
+        for (size_t depth = 1; depth < state.ndepths(); ++depth) {
+            std::cerr << "depth " << depth << ':';
+            if (state.depth(depth).empty()) return ;
+            for (const auto &info: state.depth(depth)) {
+                std::cerr << " {" << (unsigned) info.m_table_id << ", "
+                    << (unsigned) info.m_key_id << "}";
             }
             std::cerr << std::endl;
         }
-        return false;
     }
-    
-    /* @returns atEnd */
-    void init(lf_key_size_type depth) {
-        for (lf_key_size_type i = 0; i < m_iterinfo[depth].size(); ++i) {
-            if (m_iterinfo[depth][i]->atEnd()) {
-                m_pos.push_back(i);
+
+    /* @returns the exclusive upper end of the keys up to key; the largest
+     * key is already at the end of every iterator, so it saturates */
+    static attr_type key_after(attr_type key) {
+        return key == ~(attr_type) 0 ? key : key + 1;
+    }
+
+    /* restricts the depth-1 keys to [lo, hi) */
+    void restrict_range(lf_state &state, attr_type lo, attr_type hi) {
+        for (auto &iter_info: state.depth(1)) {
+            if (lo != 0) iter_info.seek(lo);
+            iter_info.m_end_key = hi;
+        }
+    }
+
+    /* splits the depth-1 domain into about nparts ranges with roughly
+     * the same number of tuples in the largest depth-1 relation.
+     * @returns the lower ends of the ranges, the first one being 0 */
+    std::vector<attr_type> partition_keys(lf_state &state, size_t nparts) const {
+        /* the samples are first keys, which tables with constants do not
+         * bind at depth 1 */
+        const relation_type *rel = nullptr;
+        for (const auto &iter_info: state.depth(1)) {
+            if (iter_info.m_key_id != 0) continue;
+            if (!rel || iter_info.m_rel->size() > rel->size())
+                rel = iter_info.m_rel;
+        }
+        if (!rel) return std::vector<attr_type>(1, 0);
+
+        std::vector<attr_type> keys = rel->sample_keys(nparts * 4);
+        if (keys.empty()) return std::vector<attr_type>(1, 0);
+
+        std::vector<attr_type> lo(1, 0);
+        for (size_t i = 1; i < nparts; ++i) {
+            attr_type key = keys[i * keys.size() / nparts];
+            if (key > lo.back()) lo.push_back(key);
+        }
+        return lo;
+    }
+
+    void init(lf_state &state, lf_key_size_type depth) {
+        lf_depth iterinfo = state.depth(depth);
+        for (lf_key_size_type i = 0; i < iterinfo.size(); ++i) {
+            if (iterinfo[i].atEnd()) {
+                state.m_pos.push_back(i);
                 return ;
             }
         }
-        std::sort(m_iterinfo[depth].begin(), m_iterinfo[depth].end(),
-                [&](const lf_iter_info *l, const lf_iter_info *r) -> bool {
-                    return l->key() < r->key();
+        std::sort(iterinfo.begin(), iterinfo.end(),
+                [&](const lf_iter_info &l, const lf_iter_info &r) -> bool {
+                    return l.key() < r.key();
                 }
         );
-        m_pos.push_back(0ull);
-        search(depth);
+        state.m_pos.push_back(0ull);
+        search(state, depth);
+    }
+
+    /* moves an iterator of depth to the first key not less than key */
+    void seek(lf_state &state, lf_key_size_type depth, lf_iter_info &iter_info, attr_type key) {
+        ++state.m_seeks;
+        if (!lf_stats_enabled) {
+            iter_info.seek(key);
+            return ;
+        }
+        cursor_type from = *iter_info.m_iter;
+        iter_info.seek(key);
+        state.m_stats.seek(depth, iter_info.m_table_id,
+                iter_info.m_rel->same_block(from, *iter_info.m_iter, iter_info.m_key_id));
     }
 
-    void search(lf_key_size_type depth) {
-        auto k = m_iterinfo[depth].size();
-        auto p = m_pos.back();
-        attr_type max_key = m_iterinfo[depth][(p + k - 1) % k]->key();
+    void search(lf_state &state, lf_key_size_type depth) {
+        lf_depth iterinfo = state.depth(depth);
+        auto k = iterinfo.size();
+        auto p = state.m_pos.back();
+        attr_type max_key = iterinfo[(p + k - 1) % k].key();
         for (;;) {
-            auto key = m_iterinfo[depth][p]->key();
+            auto key = iterinfo[p].key();
             if (key == max_key) {
                 break;
             } else {
-                m_iterinfo[depth][p]->seek(max_key);
-                if (m_iterinfo[depth][p]->atEnd()) {
+                seek(state, depth, iterinfo[p], max_key);
+                if (iterinfo[p].atEnd()) {
                     break;
                 } else {
-                    max_key = m_iterinfo[depth][p]->key();
+                    max_key = iterinfo[p].key();
                     p = (p + 1) % k;
                 }
             }
         }
-        m_pos.back() = p;
+        state.m_pos.back() = p;
+    }
+
+    void next(lf_state &state, lf_key_size_type depth) {
+        lf_depth iterinfo = state.depth(depth);
+        auto k = iterinfo.size();
+        auto p = state.m_pos.back();
+        state.m_stats.next(depth, iterinfo[p].m_table_id);
+        iterinfo[p].next();
+        ++state.m_seeks;
+        if (!iterinfo[p].atEnd()) {
+            state.m_pos.back() = (p + 1) % k;
+            search(state, depth);
+        }
+    }
+
+    /* Hands the upper half of the keys left at the shallowest active depth
+     * below the current one to a new state, which runs with the bindings of
+     * the shallower depths fixed.
+     * @returns nullptr if no depth has a key range worth splitting */
+    std::unique_ptr<lf_state> split(lf_state &state, lf_key_size_type depth) {
+        /* below the projected or group depth, both states could report
+         * the same bindings of the depths up to it */
+        lf_key_size_type max_depth = depth;
+        if (state.m_project_depth) {
+            max_depth = std::min<lf_key_size_type>(depth, state.m_project_depth + 1);
+        }
+        if (state.m_group_depth) {
+            max_depth = std::min<lf_key_size_type>(depth, state.m_group_depth + 1);
+        }
+        for (lf_key_size_type d = state.m_base_depth; d < max_depth; ++d) {
+            lf_depth iterinfo = state.depth(d);
+            attr_type cur = iterinfo[state.m_pos[d - 1]].key();
+            attr_type hi = iterinfo[0].m_end_key;
+            for (const auto &iter_info: iterinfo) {
+                hi = std::min(hi, key_after(iter_info.last_key()));
+            }
+            if (hi <= cur + 1) continue;
+            attr_type mid = cur + 1 + (hi - cur - 1) / 2;
+
+            std::unique_ptr<lf_state> stolen(new lf_state(state));
+            stolen->m_base_depth = d;
+            stolen->m_pos.resize(d - 1);
+            for (lf_key_size_type d2 = depth; d2 > d; --d2) {
+                for (auto &iter_info: stolen->depth(d2)) {
+                    iter_info.up();
+                }
+            }
+            for (auto &iter_info: stolen->depth(d)) {
+                iter_info.seek(mid);
+                iter_info.m_end_key = hi;
+            }
+            for (auto &iter_info: iterinfo) {
+                iter_info.m_end_key = mid;
+            }
+            /* the subtrees that contain depth d lose their upper keys */
+            for (lf_key_size_type d2 = 1; d2 <= d; ++d2) {
+                state.m_subtree_base[d2] = ~(uint64_t) 0;
+            }
+            return stolen;
+        }
+        return nullptr;
+    }
+
+    /* number of columns of a result */
+    size_t width(const lf_state &state) const {
+        if (state.m_group_depth) return state.m_group_depth + 1;
+        return state.m_project_depth ? state.m_project_depth : state.ndepths() - 1;
+    }
+
+    /* buffers the bindings of the depths above the last output depth
+     * followed by key */
+    void emit(lf_state &state, attr_type key) {
+        const size_t width = this->width(state);
+        for (lf_key_size_type depth = 1; depth < width; ++depth) {
+            state.m_results.push_back(state.depth(depth)[state.m_pos[depth - 1]].key());
+        }
+        state.m_results.push_back(key);
+        if (state.m_results.size() >= output_batch_size * width) {
+            flush(state);
+        }
+    }
+
+    void flush(lf_state &state) {
+        if (!state.m_output || state.m_results.empty()) return ;
+        size_t width = this->width(state);
+        state.m_output->write(state.m_results.data(), state.m_results.size() / width, width);
+        state.m_results.clear();
+    }
+
+    /* Counts the keys of the last depth into n without visiting them when
+     * a single relation binds it.
+     * @returns false if the relation cannot count them */
+    bool count_last(lf_state &state, lf_key_size_type depth, size_t &n) {
+        lf_depth iterinfo = state.depth(depth);
+        if (iterinfo.size() != 1 || !iterinfo[0].count_keys(n)) return false;
+        state.m_stats.count(depth);
+        return true;
+    }
+
+    /* Binds the last depth to every key at once by intersecting the key runs
+     * of its relations, which is where leapfrog spends most of its seeks.
+     * Unless count_only, keys points at the n keys afterwards.
+     * @returns false if some relation has no run of keys */
+    bool intersect_last(lf_state &state, lf_key_size_type depth, bool count_only,
+            size_t &n, const attr_type *&keys) {
+        lf_depth iterinfo = state.depth(depth);
+        auto &runs = state.m_runs;
+        runs.resize(iterinfo.size());
+        for (size_t i = 0; i < iterinfo.size(); ++i) {
+            /* a relation joined with itself shares one cursor, which the
+             * leapfrog seeks for both of its keys */
+            for (size_t j = 0; j < i; ++j) {
+                if (iterinfo[j].m_table_id == iterinfo[i].m_table_id) return false;
+            }
+            if (!iterinfo[i].key_run(runs[i])) return false;
+        }
+        n = lf_intersect_runs(runs.data(), runs.size(), state.m_buffers, count_only, keys);
+        state.m_stats.intersect(depth, runs.data(), runs.size(), n);
+        return true;
+    }
+
+    /* Binds the last depth at once if it can, recording the results unless
+     * projecting, and sets n to the number of its keys. When projecting,
+     * only a count that visits no keys is taken; otherwise the leapfrog
+     * stops at the first common key instead of intersecting all of them.
+     * @returns false, doing nothing, otherwise */
+    bool bind_last(lf_state &state, lf_key_size_type depth, size_t &n) {
+        if (state.m_project_depth) return count_last(state, depth, n);
+        /* the keys of the last depth are only looked at to be written out */
+        const bool count_only = !state.m_output || state.m_group_depth;
+        const attr_type *keys = nullptr;
+        if (!(count_only && count_last(state, depth, n)) &&
+                !intersect_last(state, depth, count_only, n, keys))
+            return false;
+        size_t admitted = admit(state, n);
+        state.m_count += admitted;
+        if (!count_only) {
+            for (size_t i = 0; i < admitted; ++i) {
+                emit(state, keys[i]);
+            }
+        }
+        return true;
+    }
+
+    /* Records the bindings of the depths up to the projected one once some
+     * binding of every depth extends them, and backtracks to the projected
+     * depth, whose next key is the next candidate.
+     * @param depth the deepest depth bound, whose iterators are open
+     * @returns the projected depth */
+    lf_key_size_type found(lf_state &state, lf_key_size_type depth) {
+        const lf_key_size_type project_depth = state.m_project_depth;
+        if (admit(state, 1)) {
+            ++state.m_count;
+            if (state.m_output) {
+                emit(state, state.depth(project_depth)[state.m_pos[project_depth - 1]].key());
+            }
+        }
+        for (; depth > project_depth; --depth) {
+            state.m_pos.pop_back();
+            for (auto &iter_info: state.depth(depth)) {
+                iter_info.up();
+            }
+        }
+        return depth;
+    }
+
+    /* records the number of results under the current bindings of the
+     * depths up to the group depth, once the join is back at it */
+    void close_group(lf_state &state) {
+        uint64_t n = state.m_count - state.m_group_base;
+        state.m_group_base = state.m_count;
+        if (n && state.m_output) emit(state, n);
+    }
+
+    /* @returns the bytes of subtree caches each of nworkers workers may
+     * take, a share of what cache() and the memory manager leave */
+    size_t cache_budget(size_t nworkers) const {
+        return std::min(m_cache_bytes, tpie::get_memory_manager().available()) / nworkers;
+    }
+
+    /* Picks the depths whose subtrees are cached, and sizes their caches
+     * to share bytes, from cache_budget(). These are the depths below the group depth, if any, whose
+     * results depend on the bindings of only some of the depths above
+     * them, and only if those results are counted rather than output.
+     * @returns false if no depth is cached */
+    bool prepare_cache(lf_output *output, size_t bytes, lf_subtree_cache &cache) const {
+        const size_t ndepths = nvars() + 1;
+        cache.m_depends.assign(ndepths, std::vector<lf_key_size_type>());
+        cache.m_counts.clear();
+        cache.m_counts.resize(ndepths);
+        const bool projected = m_project_depth && size_t(m_project_depth) + 1 < ndepths;
+        if (!m_cache_bytes || projected || (output && !m_group_depth)) return false;
+
+        const size_t first = std::max<size_t>(2, m_group_depth + 1);
+        size_t ncached = 0;
+        for (size_t depth = first; depth < ndepths; ++depth) {
+            /* the tables still open at depth are under the prefix of their
+             * columns of the depths above it */
+            std::vector<bool> depends(depth, false);
+            for (const auto &keyinfo: m_keyinfo) {
+                if (*std::max_element(keyinfo.begin(), keyinfo.end()) < depth) continue;
+                for (lf_key_size_type d: keyinfo) {
+                    if (d && d < depth) depends[d] = true;
+                }
+            }
+            std::vector<lf_key_size_type> &depths = cache.m_depends[depth];
+            for (lf_key_size_type d = 1; d < depth; ++d) {
+                if (depends[d]) depths.push_back(d);
+            }
+            /* every binding of all the depths above comes once */
+            if (depths.size() + 1 < depth) ++ncached;
+        }
+        if (ncached == 0) return false;
+
+        bytes /= ncached;
+        bool cached = false;
+        for (size_t depth = first; depth < ndepths; ++depth) {
+            size_t width = cache.m_depends[depth].size();
+            if (width + 1 >= depth) continue;
+            size_t capacity = std::min(bytes / lf_count_cache::entry_bytes(width),
+                    size_t(lf_count_cache::max_capacity));
+            if (capacity == 0) continue;
+            cache.m_counts[depth].reset(new lf_count_cache(width, capacity));
+            cached = true;
+        }
+        cache.m_key.reserve(ndepths);
+        return cached;
+    }
+
+    /* the bindings of the depths that the subtree of depth depends on */
+    const attr_type *subtree_key(lf_state &state, lf_key_size_type depth) {
+        std::vector<attr_type> &key = state.m_cache->m_key;
+        key.clear();
+        for (lf_key_size_type d: state.m_cache->m_depends[depth]) {
+            key.push_back(state.depth(d)[state.m_pos[d - 1]].key());
+        }
+        return key.data();
     }
 
-    void next(lf_key_size_type depth) {
-        auto k = m_iterinfo[depth].size();
-        auto p = m_pos.back();
-        m_iterinfo[depth][p]->next();
-        if (!m_iterinfo[depth][p]->atEnd()) {
-            m_pos.back() = (p + 1) % k;
-            search(depth);
+    /* Counts the results under the current bindings of the depths above
+     * depth at once if the cache has them, and otherwise starts recording
+     * their count for store_subtree().
+     * @returns whether the cache had them */
+    bool lookup_subtree(lf_state &state, lf_key_size_type depth) {
+        lf_count_cache *counts = state.m_cache->m_counts[depth].get();
+        if (!counts) return false;
+        uint64_t n;
+        if (counts->find(subtree_key(state, depth), n)) {
+            state.m_stats.cache_hit(depth);
+            state.m_count += admit(state, n);
+            return true;
         }
+        state.m_stats.cache_miss(depth);
+        state.m_subtree_base[depth] = state.m_count;
+        return false;
     }
 
-    void do_join() {
-        m_pos.clear();
-        lf_key_size_type depth = 1;
-        while (depth != 0) {
-            if (m_pos.size() != depth) {
-                init(depth);
+    /* caches the count of the subtree of depth once the join is done with
+     * it, unless it was split or the run stopped within it */
+    void store_subtree(lf_state &state, lf_key_size_type depth) {
+        uint64_t base = state.m_subtree_base[depth];
+        if (base == ~(uint64_t) 0) return ;
+        state.m_subtree_base[depth] = ~(uint64_t) 0;
+        if (state.m_control->m_stopped.load(std::memory_order_relaxed)) return ;
+        state.m_cache->m_counts[depth]->insert(subtree_key(state, depth), state.m_count - base);
+    }
+
+    /* @returns how many of n more results the limit leaves room for,
+     * stopping the run once there is no room left */
+    uint64_t admit(lf_state &state, uint64_t n) {
+        if (!m_limit) return n;
+        std::atomic<uint64_t> &room = state.m_control->m_room;
+        uint64_t left = room.load(std::memory_order_relaxed);
+        while (!room.compare_exchange_weak(left, left - std::min(left, n),
+                    std::memory_order_relaxed)) {}
+        if (left <= n) {
+            state.m_control->m_stopped.store(true, std::memory_order_relaxed);
+            return left;
+        }
+        return n;
+    }
+
+    /* hands the seeks done since the last poll to the cancel token, which
+     * may stop the run */
+    void poll(lf_state &state) {
+        lf_cancel_token *token = state.m_control->m_token;
+        if (!token) return ;
+        if (token->poll(state.m_seeks - state.m_polled_seeks)) {
+            state.m_control->m_stopped.store(true, std::memory_order_relaxed);
+        }
+        state.m_polled_seeks = state.m_seeks;
+    }
+
+    /* @returns about how many depth-1 keys a state that has not started,
+     * or has stopped, had left */
+    double keys_left(lf_state &state) const {
+        if (state.m_base_depth != 1) return 0;
+        attr_type cur = 0, hi = ~(attr_type) 0;
+        for (const auto &iter_info: state.depth(1)) {
+            if (iter_info.atEnd()) return 0;
+            cur = std::max(cur, iter_info.key());
+            hi = std::min({hi, iter_info.m_end_key, key_after(iter_info.last_key())});
+        }
+        return hi > cur ? (double) (hi - cur) : 0;
+    }
+
+    /* records how a run with total depth-1 keys ended */
+    void finish_run(const lf_run_control &control, double total, double keys_left) {
+        m_stopped = control.m_stopped;
+        m_progress = !m_stopped ? 1 :
+            total > 0 ? std::max(0.0, std::min(1.0, 1 - keys_left / total)) : 0;
+    }
+
+    void do_join(lf_state &state, lf_scheduler *sched = nullptr) {
+        const size_t ndepths = state.ndepths();
+        lf_key_size_type depth = state.m_base_depth;
+        state.m_pos.resize(depth - 1);
+        uint64_t split_backoff = 0;
+        /* poll the cancel token right away, which may have been cancelled
+         * before the run */
+        uint64_t until_poll = 1;
+        while (depth >= state.m_base_depth) {
+            state.m_stats.tick(depth);
+            if (--until_poll == 0) {
+                until_poll = poll_interval;
+                poll(state);
+            }
+            if (state.m_control->m_stopped.load(std::memory_order_relaxed)) {
+                state.m_keys_left = keys_left(state);
+                break;
+            }
+            if (split_backoff) {
+                --split_backoff;
+            } else if (sched && sched->m_hungry.load(std::memory_order_relaxed)) {
+                std::unique_ptr<lf_state> stolen = split(state, depth);
+                if (stolen) {
+                    sched->push(std::move(stolen));
+                } else {
+                    split_backoff = 1024;
+                }
+            }
+            if (state.m_pos.size() != depth) {
+                init(state, depth);
             } else {
-                next(depth);
+                next(state, depth);
             }
-            auto p = m_pos.back();
-            if (m_iterinfo[depth][p]->atEnd()) {
-                m_pos.pop_back();
-                for (auto iter_info: m_iterinfo[depth]) {
-                    iter_info->up();
+            auto p = state.m_pos.back();
+            lf_depth iterinfo = state.depth(depth);
+            if (iterinfo[p].atEnd()) {
+                state.m_stats.backtrack(depth);
+                state.m_pos.pop_back();
+                for (auto &iter_info: iterinfo) {
+                    iter_info.up();
                 }
+                if (state.m_cache) store_subtree(state, depth);
                 --depth;
+                if (depth == state.m_group_depth && depth) close_group(state);
             } else {
-                if (depth + 1 == m_iterinfo.size()) {
-                    /*for (lf_key_size_type i = 1; i < m_iterinfo.size(); ++i) {
-                        std::cout << m_iterinfo[i][0]->key() << ' ';
+                state.m_stats.bind(depth);
+                if (size_t(depth) + 1 == ndepths) {
+                    if (state.m_project_depth) {
+                        depth = found(state, depth);
+                    } else if (admit(state, 1)) {
+                        ++state.m_count;
+                        if (state.m_output && !state.m_group_depth) {
+                            emit(state, iterinfo[p].key());
+                        }
                     }
-                    std::cout << std::endl; */
-                    ++m_count;
                 } else {
                     ++depth;
-                    for (auto iter_info: m_iterinfo[depth]) {
-                        iter_info->open();
+                    if (state.m_cache && lookup_subtree(state, depth)) {
+                        --depth;
+                        if (depth == state.m_group_depth) close_group(state);
+                        continue;
+                    }
+                    for (auto &iter_info: state.depth(depth)) {
+                        iter_info.open();
                     }
+                    size_t n;
+                    if (size_t(depth) + 1 == ndepths && bind_last(state, depth, n)) {
+                        if (state.m_cache) store_subtree(state, depth);
+                        for (auto &iter_info: state.depth(depth)) {
+                            iter_info.up();
+                        }
+                        --depth;
+                        if (state.m_project_depth && n) depth = found(state, depth);
+                        if (depth == state.m_group_depth) close_group(state);
+                    }
+                }
+            }
+        }
+        state.m_stats.tick(0);
+        poll(state);
+        flush(state);
+    }
+
+    /* Splits the sorted depths into the groups of depths that no table
+     * connects, each sorted, in the order of their first depths. */
+    std::vector<lf_factorized::depth_list> independent_groups(
+            const lf_factorized::depth_list &depths) const {
+        std::vector<lf_key_size_type> group(nvars() + 1, 0);
+        for (lf_key_size_type d: depths) group[d] = d;
+        auto find = [&](lf_key_size_type d) -> lf_key_size_type {
+            while (group[d] != d) d = group[d] = group[group[d]];
+            return d;
+        };
+        /* every group is named after its first depth */
+        for (const auto &keyinfo: m_keyinfo) {
+            lf_key_size_type first = 0;
+            for (lf_key_size_type d: keyinfo) {
+                if (d == 0 || group[d] == 0) continue;
+                if (first) {
+                    lf_key_size_type g = find(d), h = find(first);
+                    group[std::max(g, h)] = std::min(g, h);
+                }
+                first = d;
+            }
+        }
+        std::vector<lf_factorized::depth_list> groups;
+        std::vector<size_t> index(nvars() + 1, 0);
+        for (lf_key_size_type d: depths) {
+            lf_key_size_type g = find(d);
+            if (g == d) {
+                index[g] = groups.size();
+                groups.emplace_back();
+            }
+            groups[index[g]].push_back(d);
+        }
+        return groups;
+    }
+
+    /* adds the first depth of every group of depths to the children of
+     * parent, and the other depths of the group under it */
+    void build_factor_tree(lf_factorized &result, lf_key_size_type parent,
+            const lf_factorized::depth_list &depths) const {
+        for (const auto &group: independent_groups(depths)) {
+            result.m_children[parent].push_back(group[0]);
+            build_factor_tree(result, group[0],
+                    lf_factorized::depth_list(group.begin() + 1, group.end()));
+        }
+    }
+
+    /* Appends the union of the keys of depth under the current bindings of
+     * its ancestors in the factor tree, the other shallower depths being
+     * left alone.
+     * @returns whether the union has some key */
+    bool factorize_union(lf_state &state, lf_factorized &result, lf_key_size_type depth) {
+        std::vector<uint64_t> &data = result.m_data;
+        const size_t head = data.size();
+        data.push_back(0);
+        data.push_back(0);
+        lf_depth iterinfo = state.depth(depth);
+        /* depth 1 starts where prepare_iterinfo() put it */
+        if (depth > 1) {
+            for (auto &iter_info: iterinfo) {
+                iter_info.open();
+            }
+        }
+        /* init() and next() work on the last position; those of the depths
+         * that are not ancestors are left over from other unions */
+        state.m_pos.resize(depth - 1);
+        init(state, depth);
+        uint64_t nkeys = 0;
+        while (!iterinfo[state.m_pos[depth - 1]].atEnd()) {
+            const size_t entry = data.size();
+            data.push_back(iterinfo[state.m_pos[depth - 1]].key());
+            bool found = true;
+            for (lf_key_size_type child: result.m_children[depth]) {
+                if (!factorize_union(state, result, child)) {
+                    found = false;
+                    break;
                 }
             }
+            if (found) {
+                ++nkeys;
+            } else {
+                data.resize(entry);
+            }
+            state.m_pos.resize(depth);
+            next(state, depth);
+        }
+        state.m_pos.resize(depth - 1);
+        for (auto &iter_info: iterinfo) {
+            iter_info.up();
+        }
+        data[head] = nkeys;
+        data[head + 1] = data.size() - head - 2;
+        return nkeys != 0;
+    }
+
+    uint64_t run_join(lf_output *output) {
+        m_stopped = false;
+        m_progress = 1;
+        if (seek_constants()) return 0;
+        /* only constants, which all match */
+        if (nvars() == 0) return 1;
+        lf_run_control control(m_limit, m_cancel_token);
+        lf_state state;
+        bool empty_depth = prepare_iterinfo(state);
+        print_iterinfo(state);
+        if (empty_depth) return 0;
+        state.m_output = output;
+        state.m_control = &control;
+        lf_subtree_cache cache;
+        if (prepare_cache(output, cache_budget(1), cache)) state.m_cache = &cache;
+        double total = keys_left(state);
+        do_join(state);
+        finish_run(control, total, state.m_keys_left);
+        m_stats = state.m_stats;
+        return state.m_count;
+    }
+
+    uint64_t run_parallel_join(lf_output *output, size_t nparts) {
+        m_stopped = false;
+        m_progress = 1;
+        if (seek_constants()) return 0;
+        if (nvars() == 0) return 1;
+        lf_run_control control(m_limit, m_cancel_token);
+        size_t nworkers = std::max<size_t>(tpie::default_worker_count(), 1);
+        lf_scheduler sched;
+        double total;
+        {
+            lf_state state;
+            bool empty_depth = prepare_iterinfo(state);
+            print_iterinfo(state);
+            if (empty_depth) return 0;
+            total = keys_left(state);
+            if (nparts == 0) nparts = nworkers;
+            std::vector<attr_type> lo = partition_keys(state, nparts);
+            std::cerr << "partitions = " << lo.size() << std::endl;
+            for (size_t i = lo.size(); i-- > 0; ) {
+                attr_type hi = (i + 1 == lo.size()) ? ~(attr_type) 0 : lo[i + 1];
+                std::unique_ptr<lf_state> range(new lf_state);
+                prepare_iterinfo(*range);
+                restrict_range(*range, lo[i], hi);
+                range->m_output = output;
+                range->m_control = &control;
+                sched.m_states.push_back(std::move(range));
+            }
+        }
+
+        std::vector<std::unique_ptr<lf_worker_job>> jobs;
+        /* taken before the first cache so that every worker gets as much */
+        const size_t cache_bytes = cache_budget(nworkers);
+        for (size_t i = 0; i < nworkers; ++i) {
+            jobs.emplace_back(new lf_worker_job(this, &sched));
+            jobs.back()->m_cached = prepare_cache(output, cache_bytes, jobs.back()->m_cache);
+            jobs.back()->enqueue();
+        }
+
+        uint64_t count = 0;
+        double keys_left = 0;
+        m_stats = lf_stats_type();
+        for (auto &job: jobs) {
+            job->join();
+            count += job->m_count;
+            keys_left += job->m_keys_left;
+            m_stats.merge(job->m_stats);
         }
+        finish_run(control, total, keys_left);
+        return count;
     }
 
 public:
+    /* Only outputs and counts the distinct bindings of depths 1 to depth.
+     * The deeper depths are only checked for some binding, the first one
+     * found being enough to backtrack. The results still come in trie
+     * order, so they are distinct without a pass to remove duplicates.
+     * @param depth 0 to output every depth */
+    void project(lf_key_size_type depth) {
+        m_project_depth = depth;
+    }
+
+    /* Outputs, instead of the results, the bindings of depths 1 to depth
+     * that some results extend, each followed by the number of those
+     * results, in key order unless the join is parallel. The counts are
+     * summed as the join backtracks to depth, so the last depths are only
+     * counted. The joins still return the total number of results.
+     * @param depth less than the number of depths, 0 not to group */
+    void group_by(lf_key_size_type depth) {
+        m_group_depth = depth;
+    }
+
+    /* Stops the joins after k results, 0 for no limit. Parallel joins
+     * return k results too, just not the first k. */
+    void limit(uint64_t k) {
+        m_limit = k;
+    }
+
+    /* Lets the joins that count their results, or group them, cache the
+     * number of results under the bindings of the depths above some depth
+     * whose tables only depend on some of those, such as the last depth of
+     * a 4-cycle, which only depends on depths 1 and 3. A subtree met again
+     * under the same bindings is then counted without being joined again.
+     * Each worker keeps its own caches, which drop their least recently
+     * used counts when full.
+     * @param bytes the memory of the caches of all the workers, at most
+     * what the TPIE memory manager has available; 0 for no caches */
+    void cache(size_t bytes) {
+        m_cache_bytes = bytes;
+    }
+
+    /* makes the joins poll token, which may stop them early; nullptr
+     * for none */
+    void cancel_with(lf_cancel_token *token) {
+        m_cancel_token = token;
+    }
+
+    /* @returns whether the last join was stopped by its limit or its
+     * cancel token */
+    bool stopped() const {
+        return m_stopped;
+    }
+
+    /* @returns the estimated fraction of the last join that was done,
+     * from the depth-1 keys it went through; 1 if it was not stopped */
+    double progress() const {
+        return m_progress;
+    }
+
+    /* @returns the counters of the last join, empty unless built with
+     * LF_STATS */
+    const lf_stats_type &stats() const {
+        return m_stats;
+    }
+
     uint64_t join_count() {
-        if (prepare_iterinfo()) return 0;
-        m_count = 0;
-        do_join();
-        return m_count;
+        return run_join(nullptr);
+    }
+
+    /* Joins into result, which lists every binding of a depth once per
+     * binding of its ancestors in the factor tree of the query rather than
+     * once per binding of all the shallower depths; see lf_factorized. A
+     * star of k leaves around depth 1 then takes the keys of the leaves
+     * instead of the product of their keys. Runs on one thread, without
+     * projection, grouping, limit or cancel token.
+     * @returns the number of results */
+    uint64_t join_factorized(lf_factorized &result) {
+        tp_assert(!m_project_depth && !m_group_depth && !m_limit && !m_cancel_token,
+                "Factorized joins output every result");
+        m_stopped = false;
+        m_progress = 1;
+        const size_t nvars = this->nvars();
+        result.m_nvars = nvars;
+        result.m_children.assign(nvars + 1, lf_factorized::depth_list());
+        result.m_data.clear();
+        result.m_empty = true;
+        lf_factorized::depth_list depths;
+        for (size_t d = 1; d <= nvars; ++d) depths.push_back(d);
+        build_factor_tree(result, 0, depths);
+        if (seek_constants()) return 0;
+        lf_run_control control(0, nullptr);
+        lf_state state;
+        bool empty_depth = prepare_iterinfo(state);
+        print_iterinfo(state);
+        if (empty_depth) return 0;
+        state.m_control = &control;
+        result.m_empty = false;
+        for (lf_key_size_type root: result.m_children[0]) {
+            if (!factorize_union(state, result, root)) {
+                result.m_empty = true;
+                break;
+            }
+        }
+        m_stats = state.m_stats;
+        return result.count();
+    }
+
+    /* writes every result to output
+     * @returns the number of results */
+    uint64_t join(lf_output &output) {
+        return run_join(&output);
+    }
+
+    /* calls f(const attr_type *tuple, size_t width) on every result */
+    template <typename F>
+    uint64_t join_visit(F f) {
+        lf_visitor_output<F> output(std::move(f));
+        return run_join(&output);
+    }
+
+    /* Splits the depth-1 keys into ranges that are joined on the job
+     * threads started by tpie::init_job(). Workers that run out of ranges
+     * steal the upper half of the keys left at some depth of a busy worker.
+     * The btrees are only read, which is only thread-safe for internal
+     * btrees.
+     * @param nparts number of initial ranges, 0 for one per worker thread */
+    template <typename X=tpie::bbits::enab>
+    uint64_t parallel_join_count(size_t nparts = 0,
+            tpie::bbits::enable<X, is_internal> = tpie::bbits::enab()) {
+        return run_parallel_join(nullptr, nparts);
+    }
+
+    /* parallel version of join(); the results come in no particular order */
+    template <typename X=tpie::bbits::enab>
+    uint64_t parallel_join(lf_output &output, size_t nparts = 0,
+            tpie::bbits::enable<X, is_internal> = tpie::bbits::enab()) {
+        return run_parallel_join(&output, nparts);
     }
 };
 
@@ -0,0 +1,340 @@
+#ifndef LEAPFROG_PIPELINING_H
+#define LEAPFROG_PIPELINING_H
+
+#include "leapfrog.h"
+#include "lf_ntriples.h"
+#include <tpie/pipelining.h>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <stdexcept>
+
+/* pipelining node that runs a join and pushes every result as an
+ * lf_tuple<N>, N being the output_width() of the join */
+template <typename dest_t, typename join_t>
+class lf_join_input_t: public tpie::pipelining::node {
+public:
+    typedef typename tpie::pipelining::push_type<dest_t>::type item_type;
+    static constexpr size_t width = std::tuple_size<item_type>::value;
+
+    lf_join_input_t(dest_t dest, join_t &join, bool parallel)
+        : m_dest(std::move(dest)), m_join(join), m_parallel(parallel) {
+        add_push_destination(m_dest);
+        set_name("Leapfrog join", tpie::pipelining::PRIORITY_INSIGNIFICANT);
+    }
+
+    virtual void go() override {
+        if (m_join.output_width() != width) {
+            throw std::invalid_argument("item width does not match the width of the results");
+        }
+        dest_output output(m_dest);
+        run(output, std::integral_constant<bool, join_t::is_internal>());
+    }
+
+private:
+    /* results come in batches from the join threads; push them one
+     * batch at a time */
+    struct dest_output: public lf_output {
+        dest_t &m_dest;
+        std::mutex m_mutex;
+
+        dest_output(dest_t &dest): m_dest(dest) {}
+
+        /* go() has checked that the rows are as wide as an item */
+        virtual void write(const attr_type *tuples, size_t ntuples, size_t width) override {
+            if (width != lf_join_input_t::width) {
+                throw std::invalid_argument("row width does not match the item width");
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            item_type item;
+            for (size_t i = 0; i < ntuples; ++i) {
+                std::copy(tuples + i * width, tuples + (i + 1) * width, item.begin());
+                m_dest.push(item);
+            }
+        }
+    };
+
+    void run(lf_output &output, std::true_type) {
+        if (m_parallel) {
+            m_join.parallel_join(output);
+        } else {
+            m_join.join(output);
+        }
+    }
+
+    void run(lf_output &output, std::false_type) {
+        m_join.join(output);
+    }
+
+    dest_t m_dest;
+    join_t &m_join;
+    bool m_parallel;
+};
+
+/* Pipelining node that pushes the results of join as lf_tuple<N>s.
+ * @param parallel use the job threads; only for internal btrees */
+template <typename join_t>
+inline tpie::pipelining::pipe_begin<tpie::pipelining::tfactory<lf_join_input_t,
+    tpie::pipelining::Args<join_t>, join_t &, bool>>
+lf_join_input(join_t &join, bool parallel = false) {
+    return {join, parallel};
+}
+
+/* how an lf_ntriples_input ended */
+struct lf_ingest_status {
+    bool m_ok = true;
+    /* what went wrong otherwise */
+    std::string m_error;
+};
+
+/* the triples of a chunk with their terms numbered in the order they first
+ * appear in it, the terms being slices of the mapped file */
+struct lf_encode_slot {
+    std::vector<lf_term> m_terms;
+    std::unordered_map<lf_term, uint32_t, lf_term_hash> m_index;
+    /* subject, predicate and object of every triple */
+    std::vector<std::array<uint32_t, 3>> m_triples;
+    /* the id of every term */
+    std::vector<attr_type> m_ids;
+
+    uint32_t index(const lf_term &t) {
+        auto it = m_index.emplace(t, (uint32_t) m_terms.size());
+        if (it.second) m_terms.push_back(t);
+        return it.first->second;
+    }
+};
+
+/* pipelining node that parses N-Triples files once and pushes every
+ * triple as (predicate, subject, object) ids, the ids coming from
+ * encode(const lf_term &), which numbers the terms it has not seen */
+template <typename dest_t, typename encoder_t>
+class lf_ntriples_input_t: public tpie::pipelining::node {
+public:
+    typedef typename tpie::pipelining::push_type<dest_t>::type item_type;
+
+    lf_ntriples_input_t(dest_t dest, std::vector<std::string> paths, size_t nslots,
+            size_t chunk_size, encoder_t encode, lf_ingest_status &status)
+        : m_dest(std::move(dest)), m_paths(std::move(paths)), m_nslots(nslots),
+          m_chunk_size(chunk_size), m_encode(std::move(encode)), m_status(status) {
+        add_push_destination(m_dest);
+        set_name("Parse N-Triples", tpie::pipelining::PRIORITY_INSIGNIFICANT);
+    }
+
+    /* The job threads parse the chunks and number their terms; then this
+     * thread encodes the distinct terms of every chunk, in the order of
+     * the chunks, so the ids are those of a scan on one thread. */
+    virtual void go() override {
+        std::vector<lf_encode_slot> slots(m_nslots);
+        for (const std::string &path: m_paths) {
+            std::string bad_line;
+            bool ok = lf_parse_ntriples(path, slots, m_chunk_size,
+                [](lf_encode_slot &slot, const lf_term &s, const lf_term &p, const lf_term &o) {
+                    slot.m_triples.push_back({{slot.index(s), slot.index(p), slot.index(o)}});
+                },
+                [&](lf_encode_slot &slot) {
+                    slot.m_ids.resize(slot.m_terms.size());
+                    for (size_t i = 0; i < slot.m_terms.size(); ++i) {
+                        slot.m_ids[i] = m_encode(slot.m_terms[i]);
+                    }
+                    for (const auto &t: slot.m_triples) {
+                        m_dest.push(item_type(slot.m_ids[t[1]], slot.m_ids[t[0]],
+                                    slot.m_ids[t[2]]));
+                    }
+                    slot.m_terms.clear();
+                    slot.m_index.clear();
+                    slot.m_triples.clear();
+                }, bad_line);
+            if (!ok) {
+                m_status.m_ok = false;
+                m_status.m_error = bad_line.empty() ? "cannot read " + path : bad_line;
+                return ;
+            }
+        }
+    }
+
+private:
+    dest_t m_dest;
+    std::vector<std::string> m_paths;
+    size_t m_nslots, m_chunk_size;
+    encoder_t m_encode;
+    lf_ingest_status &m_status;
+};
+
+/* Pipelining node that pushes the triples of the files at paths, parsed
+ * in chunks of about chunk_size bytes on nslots job threads at once.
+ * @param status whether all the files were parsed */
+template <typename encoder_t>
+inline tpie::pipelining::pipe_begin<tpie::pipelining::tfactory<lf_ntriples_input_t,
+    tpie::pipelining::Args<encoder_t>, std::vector<std::string>, size_t, size_t,
+    encoder_t, lf_ingest_status &>>
+lf_ntriples_input(std::vector<std::string> paths, size_t nslots, size_t chunk_size,
+        encoder_t encode, lf_ingest_status &status) {
+    return {std::move(paths), nslots, chunk_size, std::move(encode), status};
+}
+
+/* a term of an input triple and where it is, 3 * the number of the triple
+ * + 0, 1 or 2 for its predicate, subject or object */
+struct lf_term_occurrence {
+    std::string m_term;
+    uint64_t m_position;
+
+    bool operator<(const lf_term_occurrence &o) const {
+        int c = m_term.compare(o.m_term);
+        return c < 0 || (c == 0 && m_position < o.m_position);
+    }
+};
+
+template <typename D>
+void serialize(D &dst, const lf_term_occurrence &v) {
+    using tpie::serialize;
+    serialize(dst, v.m_term);
+    serialize(dst, v.m_position);
+}
+
+template <typename S>
+void unserialize(S &src, lf_term_occurrence &v) {
+    using tpie::unserialize;
+    unserialize(src, v.m_term);
+    unserialize(src, v.m_position);
+}
+
+/* pipelining node that parses N-Triples files once and pushes every term
+ * of every triple as an lf_term_occurrence, in the order of the files */
+template <typename dest_t>
+class lf_ntriples_terms_t: public tpie::pipelining::node {
+public:
+    lf_ntriples_terms_t(dest_t dest, std::vector<std::string> paths, size_t nslots,
+            size_t chunk_size, lf_ingest_status &status)
+        : m_dest(std::move(dest)), m_paths(std::move(paths)), m_nslots(nslots),
+          m_chunk_size(chunk_size), m_status(status) {
+        add_push_destination(m_dest);
+        set_name("Parse N-Triples terms", tpie::pipelining::PRIORITY_INSIGNIFICANT);
+    }
+
+    virtual void go() override {
+        /* the predicate, subject and object of every triple of a chunk */
+        std::vector<std::vector<lf_term>> slots(m_nslots);
+        lf_term_occurrence occurrence;
+        occurrence.m_position = 0;
+        for (const std::string &path: m_paths) {
+            std::string bad_line;
+            bool ok = lf_parse_ntriples(path, slots, m_chunk_size,
+                [](std::vector<lf_term> &slot, const lf_term &s, const lf_term &p, const lf_term &o) {
+                    slot.push_back(p);
+                    slot.push_back(s);
+                    slot.push_back(o);
+                },
+                [&](std::vector<lf_term> &slot) {
+                    for (const lf_term &t: slot) {
+                        t.assign_to(occurrence.m_term);
+                        m_dest.push(occurrence);
+                        ++occurrence.m_position;
+                    }
+                    slot.clear();
+                }, bad_line);
+            if (!ok) {
+                m_status.m_ok = false;
+                m_status.m_error = bad_line.empty() ? "cannot read " + path : bad_line;
+                return ;
+            }
+        }
+    }
+
+private:
+    dest_t m_dest;
+    std::vector<std::string> m_paths;
+    size_t m_nslots, m_chunk_size;
+    lf_ingest_status &m_status;
+};
+
+/* Pipelining node that pushes the terms of the files at paths with their
+ * positions, for lf_number_terms() once sorted.
+ * @param status whether all the files were parsed */
+inline tpie::pipelining::pipe_begin<tpie::pipelining::factory<lf_ntriples_terms_t,
+    std::vector<std::string>, size_t, size_t, lf_ingest_status &>>
+lf_ntriples_terms(std::vector<std::string> paths, size_t nslots, size_t chunk_size,
+        lf_ingest_status &status) {
+    return {std::move(paths), nslots, chunk_size, status};
+}
+
+/* pipelining node that takes the term occurrences sorted by term, numbers
+ * the distinct terms from 0 in that order, calling name(const std::string &)
+ * on each, and pushes (position, id) for every occurrence */
+template <typename dest_t, typename namer_t>
+class lf_number_terms_t: public tpie::pipelining::node {
+public:
+    typedef lf_term_occurrence item_type;
+
+    lf_number_terms_t(dest_t dest, namer_t name)
+        : m_dest(std::move(dest)), m_name(std::move(name)) {
+        add_push_destination(m_dest);
+        set_name("Number terms", tpie::pipelining::PRIORITY_INSIGNIFICANT);
+    }
+
+    virtual void begin() override {
+        m_first = true;
+        m_next_id = 0;
+    }
+
+    void push(const item_type &item) {
+        if (m_first || item.m_term != m_term) {
+            m_first = false;
+            m_term = item.m_term;
+            m_id = m_next_id++;
+            m_name(m_term);
+        }
+        m_dest.push(std::make_pair(item.m_position, m_id));
+    }
+
+private:
+    dest_t m_dest;
+    attr_type m_next_id, m_id;
+    namer_t m_name;
+    std::string m_term;
+    bool m_first;
+};
+
+template <typename namer_t>
+inline tpie::pipelining::pipe_middle<tpie::pipelining::tfactory<lf_number_terms_t,
+    tpie::pipelining::Args<namer_t>, namer_t>>
+lf_number_terms(namer_t name) {
+    return {std::move(name)};
+}
+
+/* pipelining node that takes the (position, id) pairs of the terms sorted
+ * by position and pushes every triple as (predicate, subject, object) ids */
+template <typename dest_t>
+class lf_assemble_triples_t: public tpie::pipelining::node {
+public:
+    typedef std::pair<uint64_t, attr_type> item_type;
+    typedef typename tpie::pipelining::push_type<dest_t>::type triple_type;
+
+    lf_assemble_triples_t(dest_t dest): m_dest(std::move(dest)) {
+        add_push_destination(m_dest);
+        set_name("Assemble triples", tpie::pipelining::PRIORITY_INSIGNIFICANT);
+    }
+
+    void push(const item_type &item) {
+        m_ids[item.first % 3] = item.second;
+        if (item.first % 3 == 2) {
+            m_dest.push(triple_type(m_ids[0], m_ids[1], m_ids[2]));
+        }
+    }
+
+private:
+    dest_t m_dest;
+    attr_type m_ids[3];
+};
+
+inline tpie::pipelining::pipe_middle<tpie::pipelining::factory<lf_assemble_triples_t>>
+lf_assemble_triples() {
+    return {};
+}
+
+#endif
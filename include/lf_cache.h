@@ -0,0 +1,139 @@
+#ifndef LF_CACHE_H
+#define LF_CACHE_H
+
+#include "common.h"
+#include "lf_relation.h"
+#include <tpie/memory.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/*
+ * Maps keys of a fixed number of attributes to counts, keeping at most a
+ * fixed number of entries and dropping the least recently used one to make
+ * room for a new one. The entries are chained by hash in one array, with
+ * the keys in another, both taken from the TPIE memory manager.
+ */
+class lf_count_cache {
+public:
+    /* the most entries a cache can have */
+    static constexpr size_t max_capacity = size_t(1) << 30;
+
+    /* @returns at most how many bytes an entry takes with keys of width
+     * attributes, counting the buckets */
+    static size_t entry_bytes(size_t width) {
+        return sizeof(entry) + width * sizeof(attr_type) + 4 * sizeof(uint32_t);
+    }
+
+    lf_count_cache(size_t width, size_t capacity)
+        : m_width(width), m_size(0), m_head(none), m_tail(none) {
+        size_t nbuckets = 1;
+        while (nbuckets < 2 * capacity) nbuckets <<= 1;
+        m_mask = nbuckets - 1;
+        m_buckets.assign(nbuckets, uint32_t(none));
+        m_entries.resize(capacity);
+        m_keys.resize(capacity * width);
+    }
+
+    size_t width() const { return m_width; }
+
+    /* Sets count to the count of key and makes it the most recently used.
+     * @returns false if key is not in the cache */
+    bool find(const attr_type *key, uint64_t &count) {
+        for (uint32_t i = m_buckets[hash(key) & m_mask]; i != none; i = m_entries[i].m_chain) {
+            if (!equal(i, key)) continue;
+            unlink(i);
+            push_front(i);
+            count = m_entries[i].m_count;
+            return true;
+        }
+        return false;
+    }
+
+    /* adds key, which must not be in the cache, evicting the least recently
+     * used key if it is full */
+    void insert(const attr_type *key, uint64_t count) {
+        if (m_entries.empty()) return ;
+        uint32_t i;
+        if (m_size < m_entries.size()) {
+            i = m_size++;
+        } else {
+            i = m_tail;
+            unlink(i);
+            unchain(i);
+        }
+        std::memcpy(&m_keys[i * m_width], key, m_width * sizeof(attr_type));
+        uint32_t &bucket = m_buckets[hash(key) & m_mask];
+        m_entries[i].m_count = count;
+        m_entries[i].m_chain = bucket;
+        bucket = i;
+        push_front(i);
+    }
+
+private:
+    static constexpr uint32_t none = ~(uint32_t) 0;
+
+    struct entry {
+        uint64_t m_count;
+        /* the next entry of the bucket, and the neighbours in the order of
+         * use, the most recent first */
+        uint32_t m_chain, m_prev, m_next;
+    };
+
+    uint64_t hash(const attr_type *key) const {
+        uint64_t h = 0;
+        for (size_t i = 0; i < m_width; ++i) {
+            h = (h ^ (uint64_t) key[i]) * 0x9e3779b97f4a7c15ull;
+        }
+        return h ^ (h >> 29);
+    }
+
+    bool equal(uint32_t i, const attr_type *key) const {
+        return std::equal(key, key + m_width, m_keys.begin() + i * m_width);
+    }
+
+    void unlink(uint32_t i) {
+        entry &e = m_entries[i];
+        (e.m_prev == none ? m_head : m_entries[e.m_prev].m_next) = e.m_next;
+        (e.m_next == none ? m_tail : m_entries[e.m_next].m_prev) = e.m_prev;
+    }
+
+    void push_front(uint32_t i) {
+        entry &e = m_entries[i];
+        e.m_prev = none;
+        e.m_next = m_head;
+        (m_head == none ? m_tail : m_entries[m_head].m_prev) = i;
+        m_head = i;
+    }
+
+    /* removes entry i from its bucket */
+    void unchain(uint32_t i) {
+        uint32_t *link = &m_buckets[hash(&m_keys[i * m_width]) & m_mask];
+        while (*link != i) link = &m_entries[*link].m_chain;
+        *link = m_entries[i].m_chain;
+    }
+
+    size_t m_width;
+    size_t m_size;
+    size_t m_mask;
+    uint32_t m_head, m_tail;
+    std::vector<uint32_t, tpie::allocator<uint32_t>> m_buckets;
+    std::vector<entry, tpie::allocator<entry>> m_entries;
+    std::vector<attr_type, tpie::allocator<attr_type>> m_keys;
+};
+
+/* the counts of the subtrees of a join that one worker has gone through,
+ * see lf_join::cache() */
+struct lf_subtree_cache {
+    /* m_depends[d] are the shallower depths that the results under a binding
+     * of the depths above d depend on, and m_counts[d] their counts by the
+     * bindings of those depths; nullptr for the depths that are not cached */
+    std::vector<std::vector<lf_key_size_type>> m_depends;
+    std::vector<std::unique_ptr<lf_count_cache>> m_counts;
+    /* scratch space for a key */
+    std::vector<attr_type> m_key;
+};
+
+#endif
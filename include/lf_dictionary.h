@@ -0,0 +1,425 @@
+#ifndef LF_DICTIONARY_H
+#define LF_DICTIONARY_H
+
+#include "common.h"
+#include "lf_ntriples.h"
+#include <tpie/memory.h>
+#include <tpie/file_stream.h>
+#include <tpie/sort.h>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+/*
+ * A dictionary of the terms of a dataset. The terms are stored end to end
+ * in one byte array, with the offset of every term in another, so a term
+ * costs its bytes and one offset. The index from terms to ids is an open
+ * addressing table whose slots hold an id with some bits of the hash of
+ * its term, so a lookup probes the slots in order and only compares the
+ * bytes of the terms whose bits match.
+ *
+ * The arrays are saved as they are in a binary file, which a dictionary
+ * maps and uses in place: opening it reads nothing but the header, and the
+ * pages of the terms and the index are read as lookups reach them. The
+ * arrays are only copied into memory when a term is added.
+ */
+
+inline std::ostream &operator<<(std::ostream &out, const lf_term &t) {
+    return out.write(t.m_data, t.m_size);
+}
+
+/* the terms of a dictionary by id, in arrays of its own or in memory
+ * attached to it */
+class lf_string_pool {
+public:
+    lf_string_pool(): m_offsets(1, 0), m_attached(false) { sync(); }
+    lf_string_pool(lf_string_pool &&) = default;
+    lf_string_pool &operator=(lf_string_pool &&) = default;
+
+    size_t size() const { return m_size; }
+
+    /* @returns the bytes of all the terms */
+    size_t bytes() const { return m_ends[m_size]; }
+
+    /* the term of id, valid until the next push_back */
+    lf_term operator[](attr_type id) const {
+        return lf_term{m_data + m_ends[id], size_t(m_ends[id + 1] - m_ends[id])};
+    }
+
+    /* the bytes of the terms and the offsets of the terms in them, one
+     * more than there are terms */
+    const char *data() const { return m_data; }
+    const uint64_t *offsets() const { return m_ends; }
+
+    void reserve(size_t nterms, size_t nbytes) {
+        detach();
+        m_offsets.reserve(nterms + 1);
+        m_bytes.reserve(nbytes);
+        sync();
+    }
+
+    void shrink_to_fit() {
+        m_offsets.shrink_to_fit();
+        m_bytes.shrink_to_fit();
+        if (!m_attached) sync();
+    }
+
+    void push_back(const char *data, size_t size) {
+        detach();
+        m_bytes.insert(m_bytes.end(), data, data + size);
+        m_offsets.push_back(m_bytes.size());
+        sync();
+    }
+
+    /* uses the n terms of data and offsets, laid out like those of data()
+     * and offsets(), which must outlive the pool or its next change */
+    void attach(const char *data, const uint64_t *offsets, size_t n) {
+        decltype(m_bytes)().swap(m_bytes);
+        decltype(m_offsets)().swap(m_offsets);
+        m_data = data;
+        m_ends = offsets;
+        m_size = n;
+        m_attached = true;
+    }
+
+    /* copies the attached terms into arrays of the pool's own */
+    void detach() {
+        if (!m_attached) return ;
+        m_bytes.assign(m_data, m_data + bytes());
+        m_offsets.assign(m_ends, m_ends + m_size + 1);
+        m_attached = false;
+        sync();
+    }
+
+private:
+    void sync() {
+        m_data = m_bytes.data();
+        m_ends = m_offsets.data();
+        m_size = m_offsets.size() - 1;
+    }
+
+    std::vector<char, tpie::allocator<char>> m_bytes;
+    /* the terms are [m_offsets[id], m_offsets[id + 1]) of m_bytes */
+    std::vector<uint64_t, tpie::allocator<uint64_t>> m_offsets;
+    /* the arrays in use, the pool's own unless attached */
+    const char *m_data;
+    const uint64_t *m_ends;
+    size_t m_size;
+    bool m_attached;
+};
+
+/* the start of a dictionary file, followed by the offsets of the terms,
+ * the slots of the index and the bytes of the terms */
+struct lf_dictionary_header {
+    char m_magic[8];
+    uint64_t m_nterms, m_nslots, m_nbytes;
+};
+
+class lf_dictionary {
+public:
+    lf_string_pool mapping;
+
+    lf_dictionary(): m_slot_data(nullptr), m_nslots(0), m_slots_attached(false) {}
+    lf_dictionary(lf_dictionary &&) = default;
+    lf_dictionary &operator=(lf_dictionary &&) = default;
+
+    size_t size() const { return mapping.size(); }
+
+    /* makes room for nterms terms of nbytes bytes together */
+    void reserve(size_t nterms, size_t nbytes) {
+        mapping.reserve(nterms, nbytes);
+        if (!fits(nterms)) rehash(nterms);
+    }
+
+    /* gives back the room left in the terms once they are all added */
+    void shrink_to_fit() {
+        mapping.shrink_to_fit();
+    }
+
+    lf_dictionary &add(const std::string &s) {
+        encode(lf_term{s.data(), s.size()});
+        return *this;
+    }
+
+    /* @returns the id of t, adding it if it is new */
+    attr_type encode(const lf_term &t) {
+        const size_t n = mapping.size() + 1;
+        if (!fits(n)) rehash(n + n / 2);
+        const uint64_t h = lf_term_hash()(t);
+        const size_t i = probe(t, h);
+        if (m_slot_data[i]) return (m_slot_data[i] & id_mask) - 1;
+        detach_slots();
+        const attr_type id = mapping.size();
+        mapping.push_back(t.m_data, t.m_size);
+        m_slots[i] = slot_of(h, id);
+        return id;
+    }
+
+    attr_type encode(const std::string &s) {
+        return encode(lf_term{s.data(), s.size()});
+    }
+
+    /* @returns false if t is not in the dictionary */
+    bool find(const lf_term &t, attr_type &id) const {
+        if (!m_nslots) return false;
+        const uint64_t slot = m_slot_data[probe(t, lf_term_hash()(t))];
+        if (!slot) return false;
+        id = (slot & id_mask) - 1;
+        return true;
+    }
+
+    bool find(const std::string &s, attr_type &id) const {
+        return find(lf_term{s.data(), s.size()}, id);
+    }
+
+    /* @returns the id of s, which must be in the dictionary */
+    attr_type lookup(const std::string &s) const {
+        attr_type id;
+        if (!find(s, id)) throw std::out_of_range("term not in the dictionary: " + s);
+        return id;
+    }
+
+    /* Maps the dictionary file at path and uses it in place.
+     * @returns false if it is not a dictionary file of this version */
+    bool open(const std::string &path) {
+        std::unique_ptr<lf_mapped_file> file(new lf_mapped_file);
+        lf_dictionary_header header;
+        if (!file->open(path, MADV_RANDOM) || file->size() < sizeof header) return false;
+        std::memcpy(&header, file->data(), sizeof header);
+        if (std::memcmp(header.m_magic, magic(), sizeof header.m_magic)) return false;
+        const uint64_t *offsets = reinterpret_cast<const uint64_t *>(file->data() + sizeof header);
+        const uint64_t *slots = offsets + header.m_nterms + 1;
+        const char *data = reinterpret_cast<const char *>(slots + header.m_nslots);
+        if (file->data() + file->size() != data + header.m_nbytes) return false;
+        mapping.attach(data, offsets, header.m_nterms);
+        decltype(m_slots)().swap(m_slots);
+        m_slot_data = slots;
+        m_nslots = header.m_nslots;
+        m_slots_attached = true;
+        m_file = std::move(file);
+        return true;
+    }
+
+    /* Writes the dictionary file that open() maps, through a temporary
+     * file so that a dictionary mapping path keeps its terms.
+     * @returns false if it cannot be written */
+    bool save(const std::string &path) const {
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            lf_dictionary_header header;
+            std::memcpy(header.m_magic, magic(), sizeof header.m_magic);
+            header.m_nterms = mapping.size();
+            header.m_nslots = m_nslots;
+            header.m_nbytes = mapping.bytes();
+            out.write(reinterpret_cast<const char *>(&header), sizeof header);
+            out.write(reinterpret_cast<const char *>(mapping.offsets()),
+                    (mapping.size() + 1) * sizeof(uint64_t));
+            out.write(reinterpret_cast<const char *>(m_slot_data), m_nslots * sizeof(uint64_t));
+            out.write(mapping.data(), mapping.bytes());
+            if (!out.good()) return false;
+        }
+        return !std::rename(tmp.c_str(), path.c_str());
+    }
+
+private:
+    friend class lf_dictionary_writer;
+
+    /* names the layout and the hash of the file; the numbers are in the
+     * byte order of the machine */
+    static const char *magic() { return "LFDICT01"; }
+
+    /* a slot is 0 if empty, otherwise the id + 1 in the low bits and the
+     * low bits of the hash of the term, which the slot position does not
+     * depend on, in the others */
+    static constexpr unsigned id_bits = 40;
+    static constexpr uint64_t id_mask = (uint64_t(1) << id_bits) - 1;
+
+    /* @returns the number of slots of a table 3/4 full with n terms */
+    static size_t table_size(size_t n) {
+        return std::max<size_t>(16, n * 4 / 3 + 1);
+    }
+
+    /* @returns the slot where the probes for a term of hash h start, which
+     * grows with h */
+    static size_t home(uint64_t h, size_t nslots) {
+        return (unsigned __int128) h * nslots >> 64;
+    }
+
+    /* @returns the slot of id, whose term has hash h */
+    static uint64_t slot_of(uint64_t h, attr_type id) {
+        return (h << id_bits) | (id + 1);
+    }
+
+    /* @returns whether n terms leave the table at most 3/4 full */
+    bool fits(size_t n) const {
+        return 4 * n <= 3 * m_nslots;
+    }
+
+    /* @returns the slot of t, or the empty slot where it goes; the probes
+     * start at a slot picked by the high bits of the hash */
+    size_t probe(const lf_term &t, uint64_t h) const {
+        const size_t nslots = m_nslots;
+        const uint64_t fingerprint = h << id_bits;
+        for (size_t i = home(h, nslots); ; i = i + 1 == nslots ? 0 : i + 1) {
+            const uint64_t slot = m_slot_data[i];
+            if (!slot) return i;
+            if ((slot & ~id_mask) == fingerprint && mapping[(slot & id_mask) - 1] == t) {
+                return i;
+            }
+        }
+    }
+
+    /* rehashes into a table 3/4 full with n terms, of any size so that it
+     * takes no more than it has to */
+    void rehash(size_t n) {
+        decltype(m_slots) slots(table_size(n), 0);
+        const uint64_t *old = m_slot_data;
+        const size_t nold = m_nslots;
+        m_slot_data = slots.data();
+        m_nslots = slots.size();
+        for (size_t i = 0; i < nold; ++i) {
+            if (!old[i]) continue;
+            const lf_term t = mapping[(old[i] & id_mask) - 1];
+            slots[probe(t, lf_term_hash()(t))] = old[i];
+        }
+        m_slots.swap(slots);
+        m_slots_attached = false;
+    }
+
+    /* copies the attached slots into an array of the dictionary's own */
+    void detach_slots() {
+        if (!m_slots_attached) return ;
+        m_slots.assign(m_slot_data, m_slot_data + m_nslots);
+        m_slot_data = m_slots.data();
+        m_slots_attached = false;
+    }
+
+    std::vector<uint64_t, tpie::allocator<uint64_t>> m_slots;
+    /* the slots in use, m_slots unless attached */
+    const uint64_t *m_slot_data;
+    size_t m_nslots;
+    bool m_slots_attached;
+    /* the file the attached arrays are in, kept until the dictionary goes */
+    std::unique_ptr<lf_mapped_file> m_file;
+};
+
+/*
+ * Writes a dictionary file from terms given in the order of their ids,
+ * in the memory TPIE has whatever their number. The terms and their
+ * offsets go to files of their own as they come, with (hash, id) pairs to
+ * a TPIE stream; finish() sorts the pairs by hash, which orders them by
+ * the slot their probes start at, and lays the slots out in one pass as
+ * inserting them in that order would, before putting the parts together.
+ */
+class lf_dictionary_writer {
+public:
+    explicit lf_dictionary_writer(const std::string &path)
+        : m_path(path), m_bytes(path + ".bytes", std::ios::binary),
+          m_offsets(path + ".offsets", std::ios::binary), m_nterms(0), m_nbytes(0) {
+        write(m_offsets, uint64_t(0));
+        m_hashes.open();
+    }
+
+    lf_dictionary_writer(const lf_dictionary_writer &) = delete;
+    lf_dictionary_writer &operator=(const lf_dictionary_writer &) = delete;
+
+    ~lf_dictionary_writer() {
+        std::remove((m_path + ".bytes").c_str());
+        std::remove((m_path + ".offsets").c_str());
+    }
+
+    /* adds t, which must not have been added, with the next id */
+    void add(const lf_term &t) {
+        m_bytes.write(t.m_data, t.m_size);
+        m_nbytes += t.m_size;
+        write(m_offsets, m_nbytes);
+        m_hashes.write(std::make_pair((uint64_t) lf_term_hash()(t), (uint64_t) m_nterms++));
+    }
+
+    void add(const std::string &s) {
+        add(lf_term{s.data(), s.size()});
+    }
+
+    /* Writes the dictionary file that lf_dictionary::open() maps.
+     * @returns false if it cannot be written */
+    bool finish() {
+        m_bytes.close();
+        m_offsets.close();
+        if (!m_bytes || !m_offsets) return false;
+        tpie::sort(m_hashes, m_hashes);
+        m_hashes.seek(0);
+
+        const std::string tmp = m_path + ".tmp";
+        std::fstream out(tmp, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        lf_dictionary_header header;
+        std::memcpy(header.m_magic, lf_dictionary::magic(), sizeof header.m_magic);
+        header.m_nterms = m_nterms;
+        header.m_nslots = lf_dictionary::table_size(m_nterms);
+        header.m_nbytes = m_nbytes;
+        out.write(reinterpret_cast<const char *>(&header), sizeof header);
+        if (!copy(m_path + ".offsets", out)) return false;
+
+        /* the slots after the last one go to the first empty ones */
+        const std::streamoff slots_begin = out.tellp();
+        std::vector<uint64_t> wrapped;
+        size_t pos = 0;
+        while (m_hashes.can_read()) {
+            const std::pair<uint64_t, uint64_t> &hash = m_hashes.read();
+            const uint64_t slot = lf_dictionary::slot_of(hash.first, hash.second);
+            if (pos == header.m_nslots) {
+                wrapped.push_back(slot);
+                continue;
+            }
+            for (size_t home = lf_dictionary::home(hash.first, header.m_nslots); pos < home; ++pos) {
+                write(out, uint64_t(0));
+            }
+            write(out, slot);
+            ++pos;
+        }
+        for (; pos < header.m_nslots; ++pos) write(out, uint64_t(0));
+        const std::streamoff slots_end = out.tellp();
+        for (size_t i = 0; !wrapped.empty(); ++i) {
+            uint64_t slot;
+            out.seekg(slots_begin + i * sizeof slot);
+            out.read(reinterpret_cast<char *>(&slot), sizeof slot);
+            if (slot) continue;
+            out.seekp(slots_begin + i * sizeof slot);
+            write(out, wrapped.back());
+            wrapped.pop_back();
+        }
+        out.seekp(slots_end);
+        if (!copy(m_path + ".bytes", out)) return false;
+        out.close();
+        return out && !std::rename(tmp.c_str(), m_path.c_str());
+    }
+
+private:
+    template <typename S>
+    static void write(S &out, uint64_t v) {
+        out.write(reinterpret_cast<const char *>(&v), sizeof v);
+    }
+
+    /* appends the file at path to out */
+    static bool copy(const std::string &path, std::ostream &out) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        if (in.peek() != std::ifstream::traits_type::eof()) out << in.rdbuf();
+        return bool(out);
+    }
+
+    std::string m_path;
+    std::ofstream m_bytes, m_offsets;
+    tpie::file_stream<std::pair<uint64_t, uint64_t>> m_hashes;
+    uint64_t m_nterms, m_nbytes;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef LF_FACTORIZED_H
+#define LF_FACTORIZED_H
+
+#include "common.h"
+#include "lf_relation.h"
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+/*
+ * The results of a join as a tree of unions of products. Every depth has
+ * the depths under it in the variable order: after binding a depth, the
+ * deeper depths split into groups that no table connects, and the first
+ * depth of each group is a child of the depth, the depths before it being
+ * all bound. A union of a depth lists its keys, each followed by one union
+ * per child under it, so the results under a key are the product of its
+ * children's results. The groups of all the depths are the roots.
+ *
+ * The unions are stored in preorder in one array, each as
+ *   nkeys, nwords, then nkeys times: key, child union, ..., child union
+ * where nwords is the length of what follows it. A key is only kept if all
+ * its child unions are non-empty.
+ */
+class lf_factorized {
+public:
+    typedef std::vector<lf_key_size_type> depth_list;
+
+    lf_factorized(): m_nvars(0), m_empty(true) {}
+
+    /* number of variables of a result */
+    size_t nvars() const { return m_nvars; }
+
+    /* the children of every depth from 1, the roots at index 0 */
+    const std::vector<depth_list> &children() const { return m_children; }
+
+    /* @returns the number of words of the representation */
+    size_t size() const { return m_data.size(); }
+
+    /* @returns whether the join has no results */
+    bool empty() const { return m_empty; }
+
+    /* @returns the number of results, i.e. the sum over the keys of every
+     * union of the product of the counts of its children */
+    uint64_t count() const {
+        if (m_empty) return 0;
+        uint64_t n = 1;
+        size_t pos = 0;
+        for (lf_key_size_type root: m_children[0]) {
+            n *= count_union(root, pos);
+        }
+        return n;
+    }
+
+    /* calls f(const attr_type *tuple, size_t width) on every result, the
+     * keys of the tuple being in depth order like the ones of lf_join */
+    template <typename F>
+    void visit(F f) const {
+        if (m_empty) return ;
+        std::vector<attr_type> tuple(m_nvars);
+        std::vector<std::pair<lf_key_size_type, size_t>> pending;
+        size_t pos = 0;
+        for (lf_key_size_type root: m_children[0]) {
+            pending.emplace_back(root, pos);
+            pos += 2 + m_data[pos + 1];
+        }
+        /* the first root is enumerated first */
+        std::reverse(pending.begin(), pending.end());
+        visit_pending(pending, tuple, f);
+    }
+
+private:
+    template <typename ...T>
+    friend struct lf_join;
+
+    uint64_t count_union(lf_key_size_type depth, size_t &pos) const {
+        uint64_t nkeys = m_data[pos];
+        pos += 2;
+        uint64_t n = 0;
+        for (uint64_t i = 0; i < nkeys; ++i) {
+            ++pos;
+            uint64_t product = 1;
+            for (lf_key_size_type child: m_children[depth]) {
+                product *= count_union(child, pos);
+            }
+            n += product;
+        }
+        return n;
+    }
+
+    /* Enumerates the product of the pending unions, the last one first.
+     * Every key of it binds its depth, and its children become pending. */
+    template <typename F>
+    void visit_pending(std::vector<std::pair<lf_key_size_type, size_t>> &pending,
+            std::vector<attr_type> &tuple, F &f) const {
+        if (pending.empty()) {
+            f(tuple.data(), tuple.size());
+            return ;
+        }
+        std::pair<lf_key_size_type, size_t> top = pending.back();
+        pending.pop_back();
+        const lf_key_size_type depth = top.first;
+        const depth_list &children = m_children[depth];
+        size_t pos = top.second;
+        uint64_t nkeys = m_data[pos];
+        pos += 2;
+        for (uint64_t i = 0; i < nkeys; ++i) {
+            tuple[depth - 1] = m_data[pos++];
+            const size_t base = pending.size();
+            for (lf_key_size_type child: children) {
+                pending.emplace_back(child, pos);
+                pos += 2 + m_data[pos + 1];
+            }
+            std::reverse(pending.begin() + base, pending.end());
+            visit_pending(pending, tuple, f);
+            pending.resize(base);
+        }
+        pending.push_back(top);
+    }
+
+    size_t m_nvars;
+    std::vector<depth_list> m_children;
+    std::vector<uint64_t> m_data;
+    bool m_empty;
+};
+
+#endif
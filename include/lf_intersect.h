@@ -0,0 +1,181 @@
+#ifndef LF_INTERSECT_H
+#define LF_INTERSECT_H
+
+#include "common.h"
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LF_INTERSECT_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Intersection of sorted runs of distinct keys. The pairwise kernels write
+ * the common keys to out, which must not overlap the inputs, or only count
+ * them if out is nullptr. lf_join only takes them for relations that store
+ * their keys in arrays, such as lf_trie_relation; btree leaves hold whole
+ * rows, which are no runs of keys.
+ */
+
+/* a sorted run of distinct keys [m_begin, m_end) */
+struct lf_run {
+    const attr_type *m_begin, *m_end;
+
+    size_t size() const { return m_end - m_begin; }
+};
+
+/* one run being this many times longer than the other makes galloping
+ * through it cheaper than merging */
+static constexpr size_t lf_gallop_ratio = 32;
+
+/* @returns the first index in [lo, hi) with a[index] >= key, or hi;
+ * probes exponentially growing distances from lo first */
+inline size_t lf_gallop(const attr_type *a, size_t lo, size_t hi, attr_type key) {
+    size_t step = 1;
+    while (lo + step < hi && a[lo + step - 1] < key) {
+        lo += step;
+        step <<= 1;
+    }
+    return std::lower_bound(a + lo, a + std::min(lo + step, hi), key) - a;
+}
+
+/* looks up every key of the short run a in the long run b */
+inline size_t lf_intersect_gallop(const attr_type *a, size_t na,
+        const attr_type *b, size_t nb, attr_type *out) {
+    size_t n = 0;
+    for (size_t i = 0, j = 0; i < na && j < nb; ++i) {
+        j = lf_gallop(b, j, nb, a[i]);
+        if (j < nb && b[j] == a[i]) {
+            if (out) out[n] = a[i];
+            ++n;
+            ++j;
+        }
+    }
+    return n;
+}
+
+inline size_t lf_intersect_scalar(const attr_type *a, size_t na,
+        const attr_type *b, size_t nb, attr_type *out) {
+    size_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (b[j] < a[i]) {
+            ++j;
+        } else {
+            if (out) out[n] = a[i];
+            ++n;
+            ++i;
+            ++j;
+        }
+    }
+    return n;
+}
+
+#ifdef LF_INTERSECT_X86
+/* compares blocks of 4 keys of a against all rotations of blocks of b and
+ * advances the block with the smaller last key */
+__attribute__((target("avx2")))
+inline size_t lf_intersect_avx2(const attr_type *a, size_t na,
+        const attr_type *b, size_t nb, attr_type *out) {
+    size_t i = 0, j = 0, n = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+        __m256i eq = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi64(va, vb),
+                    _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39))),
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)),
+                    _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93))));
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (out) {
+            for (; mask; mask &= mask - 1) {
+                out[n++] = a[i + __builtin_ctz(mask)];
+            }
+        } else {
+            n += __builtin_popcount(mask);
+        }
+        attr_type amax = a[i + 3], bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+    return n + lf_intersect_scalar(a + i, na - i, b + j, nb - j, out ? out + n : nullptr);
+}
+
+/* same with blocks of 2 keys */
+__attribute__((target("sse4.2")))
+inline size_t lf_intersect_sse42(const attr_type *a, size_t na,
+        const attr_type *b, size_t nb, attr_type *out) {
+    size_t i = 0, j = 0, n = 0;
+    while (i + 2 <= na && j + 2 <= nb) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+        __m128i eq = _mm_or_si128(_mm_cmpeq_epi64(va, vb),
+                _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb, 0x4e)));
+        unsigned mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (out) {
+            for (; mask; mask &= mask - 1) {
+                out[n++] = a[i + __builtin_ctz(mask)];
+            }
+        } else {
+            n += __builtin_popcount(mask);
+        }
+        attr_type amax = a[i + 1], bmax = b[j + 1];
+        if (amax <= bmax) i += 2;
+        if (bmax <= amax) j += 2;
+    }
+    return n + lf_intersect_scalar(a + i, na - i, b + j, nb - j, out ? out + n : nullptr);
+}
+#endif
+
+typedef size_t (*lf_intersect_kernel)(const attr_type *, size_t,
+        const attr_type *, size_t, attr_type *);
+
+/* the widest kernel the CPU supports */
+inline lf_intersect_kernel lf_select_intersect_kernel() {
+#ifdef LF_INTERSECT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return lf_intersect_avx2;
+    if (__builtin_cpu_supports("sse4.2")) return lf_intersect_sse42;
+#endif
+    return lf_intersect_scalar;
+}
+
+/* @returns the number of keys common to a and b */
+inline size_t lf_intersect(const attr_type *a, size_t na,
+        const attr_type *b, size_t nb, attr_type *out) {
+    static const lf_intersect_kernel kernel = lf_select_intersect_kernel();
+    if (na * lf_gallop_ratio < nb) return lf_intersect_gallop(a, na, b, nb, out);
+    if (nb * lf_gallop_ratio < na) return lf_intersect_gallop(b, nb, a, na, out);
+    return kernel(a, na, b, nb, out);
+}
+
+/* Intersects the k >= 1 runs, shortest first, through the two buffers.
+ * Unless count_only, result points at the common keys afterwards.
+ * @returns the number of common keys */
+inline size_t lf_intersect_runs(lf_run *runs, size_t k,
+        std::vector<attr_type> (&buffers)[2], bool count_only,
+        const attr_type *&result) {
+    std::sort(runs, runs + k, [](const lf_run &l, const lf_run &r) -> bool {
+                return l.size() < r.size();
+            });
+    lf_run cur = runs[0];
+    for (size_t i = 1; i < k && cur.size(); ++i) {
+        if (count_only && i + 1 == k) {
+            return lf_intersect(cur.m_begin, cur.size(),
+                    runs[i].m_begin, runs[i].size(), nullptr);
+        }
+        std::vector<attr_type> &out = buffers[i & 1];
+        out.resize(cur.size());
+        size_t n = lf_intersect(cur.m_begin, cur.size(),
+                runs[i].m_begin, runs[i].size(), out.data());
+        cur = lf_run{out.data(), out.data() + n};
+    }
+    result = cur.m_begin;
+    return cur.size();
+}
+
+#endif
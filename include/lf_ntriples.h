@@ -0,0 +1,209 @@
+#ifndef LF_NTRIPLES_H
+#define LF_NTRIPLES_H
+
+#include <tpie/job.h>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Parsing of N-Triples and simple Turtle files, one triple per line. The
+ * files are mapped into memory and cut at line ends into chunks that the
+ * TPIE job threads parse at once; the terms of a triple are slices of the
+ * mapping rather than copies.
+ */
+
+/* the bytes [m_data, m_data + m_size) of a mapped file */
+struct lf_term {
+    const char *m_data;
+    size_t m_size;
+
+    std::string str() const { return std::string(m_data, m_size); }
+
+    /* sets s to the term, reusing its buffer */
+    void assign_to(std::string &s) const { s.assign(m_data, m_size); }
+
+    bool operator==(const lf_term &o) const {
+        return m_size == o.m_size && !std::memcmp(m_data, o.m_data, m_size);
+    }
+};
+
+/* FNV-1a */
+struct lf_term_hash {
+    size_t operator()(const lf_term &t) const {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < t.m_size; ++i) {
+            h = (h ^ (unsigned char) t.m_data[i]) * 0x100000001b3ull;
+        }
+        return h;
+    }
+};
+
+/* @returns the first unescaped '"' in [p, end), or nullptr */
+inline const char *lf_find_quote(const char *p, const char *end) {
+    for (; p < end; ++p) {
+        if (*p == '"') return p;
+        if (*p == '\\' && ++p == end) return nullptr;
+    }
+    return nullptr;
+}
+
+/* @returns the first c in [p, end), or nullptr */
+inline const char *lf_find_char(const char *p, const char *end, char c) {
+    return p < end ? static_cast<const char *>(std::memchr(p, c, end - p)) : nullptr;
+}
+
+/* Finds the subject and predicate IRIs of the line [begin, end) and its
+ * object, an IRI or a literal, whatever surrounds them.
+ * @returns false if they are not there */
+inline bool lf_parse_triple(const char *begin, const char *end,
+        lf_term &subject, lf_term &predicate, lf_term &object) {
+    const char *p1 = lf_find_char(begin, end, '<');
+    if (!p1) return false;
+    const char *p2 = lf_find_char(p1 + 1, end, '>');
+    if (!p2) return false;
+    const char *p3 = lf_find_char(p2 + 1, end, '<');
+    if (!p3) return false;
+    const char *p4 = lf_find_char(p3 + 1, end, '>');
+    if (!p4) return false;
+    const char *p5 = p4 + 1;
+    while (p5 < end && *p5 != '<' && *p5 != '"') ++p5;
+    if (p5 == end) return false;
+    const char *p6 = *p5 == '<' ? lf_find_char(p5 + 1, end, '>') : lf_find_quote(p5 + 1, end);
+    if (!p6) return false;
+    subject = lf_term{p1, size_t(p2 - p1 + 1)};
+    predicate = lf_term{p3, size_t(p4 - p3 + 1)};
+    object = lf_term{p5, size_t(p6 - p5 + 1)};
+    return true;
+}
+
+/* a file mapped read-only into memory */
+class lf_mapped_file {
+public:
+    lf_mapped_file(): m_data(nullptr), m_size(0) {}
+    lf_mapped_file(const lf_mapped_file &) = delete;
+    lf_mapped_file &operator=(const lf_mapped_file &) = delete;
+
+    ~lf_mapped_file() {
+        if (m_data) munmap(m_data, m_size);
+    }
+
+    /* @param advice how the mapping is read, for madvise()
+     * @returns false if the file cannot be mapped */
+    bool open(const std::string &path, int advice = MADV_SEQUENTIAL) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st)) {
+            ::close(fd);
+            return false;
+        }
+        m_size = st.st_size;
+        if (m_size) {
+            void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            m_data = static_cast<char *>(p);
+            madvise(m_data, m_size, advice);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    char *m_data;
+    size_t m_size;
+};
+
+/*
+ * Parses the triples of a file on the TPIE job threads. The file is cut at
+ * line ends into chunks of about chunk_size bytes, one per slot, and the
+ * slots parse a wave of chunks at once; then flush() is called on every
+ * slot in the order of the chunks, on the calling thread, before the next
+ * wave. Blank lines and lines starting with '#' are skipped.
+ * @param parse parse(T &slot, const lf_term &subject, const lf_term
+ * &predicate, const lf_term &object) is called from the job threads
+ * @param flush flush(T &slot) is called from the calling thread
+ * @param bad_line the first line that is not a triple, if any
+ * @returns false if the file cannot be mapped or some line is not a
+ * triple */
+template <typename T, typename P, typename F>
+bool lf_parse_ntriples(const std::string &path, std::vector<T> &slots, size_t chunk_size,
+        P parse, F flush, std::string &bad_line) {
+    lf_mapped_file file;
+    if (!file.open(path)) return false;
+    const char *const data = file.data(), *const end = data + file.size();
+
+    struct parse_job: public tpie::job {
+        T *m_slot;
+        P *m_parse;
+        const char *m_begin, *m_end;
+        /* the first line that is not a triple, nullptr if none */
+        const char *m_bad;
+
+        virtual void operator()() override {
+            m_bad = nullptr;
+            lf_term s, p, o;
+            for (const char *line = m_begin; line < m_end; ) {
+                const char *eol = lf_find_char(line, m_end, '\n');
+                if (!eol) eol = m_end;
+                const char *q = line;
+                while (q < eol && *q == ' ') ++q;
+                if (q < eol && *q != '#') {
+                    if (!lf_parse_triple(line, eol, s, p, o)) {
+                        m_bad = line;
+                        return ;
+                    }
+                    (*m_parse)(*m_slot, s, p, o);
+                }
+                line = eol + 1;
+            }
+        }
+    };
+
+    /* one job per slot, made once; jobs are neither copied nor moved */
+    std::vector<parse_job> jobs(slots.size());
+    for (const char *begin = data; begin < end; ) {
+        size_t njobs = 0;
+        for (; njobs < slots.size() && begin < end; ++njobs) {
+            const char *stop = begin + std::min<size_t>(chunk_size, end - begin);
+            if (stop < end) {
+                const char *eol = lf_find_char(stop, end, '\n');
+                stop = eol ? eol + 1 : end;
+            }
+            parse_job &job = jobs[njobs];
+            job.m_slot = &slots[njobs];
+            job.m_parse = &parse;
+            job.m_begin = begin;
+            job.m_end = stop;
+            job.enqueue();
+            begin = stop;
+        }
+        for (size_t i = 0; i < njobs; ++i) {
+            jobs[i].join();
+        }
+        for (size_t i = 0; i < njobs; ++i) {
+            if (jobs[i].m_bad) {
+                const char *eol = lf_find_char(jobs[i].m_bad, jobs[i].m_end, '\n');
+                bad_line.assign(jobs[i].m_bad, eol ? eol : jobs[i].m_end);
+                return false;
+            }
+            flush(slots[i]);
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef LF_OPTIMIZER_H
+#define LF_OPTIMIZER_H
+
+#include "common.h"
+#include "lf_relation.h"
+#include <tpie/file_stream.h>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+/* degree statistics of one side of a relation */
+struct lf_side_stats {
+    uint64_t m_distinct;
+    uint64_t m_max_degree;
+    /* sum of the squared degrees. Divided by the size of the relation, it is
+     * the expected degree of the key of a random value, which exceeds the
+     * average degree as much as the degrees are skewed. */
+    double m_degree_sq;
+};
+
+struct lf_predicate_stats {
+    uint64_t m_size;
+    lf_side_stats m_subject, m_object;
+};
+
+/* the statistics of a side from its keys, given in sorted order */
+class lf_side_stats_builder {
+public:
+    lf_side_stats_builder(): m_stats{0, 0, 0.0}, m_key(0), m_degree(0) {}
+
+    void push(attr_type key) {
+        if (m_degree && key == m_key) {
+            ++m_degree;
+            return ;
+        }
+        add_degree();
+        ++m_stats.m_distinct;
+        m_key = key;
+        m_degree = 1;
+    }
+
+    lf_side_stats stats() const {
+        lf_side_stats_builder last(*this);
+        last.add_degree();
+        return last.m_stats;
+    }
+
+private:
+    void add_degree() {
+        if (!m_degree) return ;
+        m_stats.m_max_degree = std::max(m_stats.m_max_degree, m_degree);
+        m_stats.m_degree_sq += (double) m_degree * m_degree;
+    }
+
+    lf_side_stats m_stats;
+    attr_type m_key;
+    uint64_t m_degree;
+};
+
+/* scans a file sorted by the side of interest, i.e. a .dat file for the
+ * subjects or an r.dat file for the objects */
+inline lf_side_stats lf_scan_side_stats(tpie::file_stream<value_type> &in) {
+    lf_side_stats_builder builder;
+    while (in.can_read()) builder.push(in.read().key1);
+    return builder.stats();
+}
+
+/* predicate(subject, object) in a query, variables being numbered from 1.
+ * Variable 0 stands for a constant, which is always bound. */
+struct lf_atom {
+    lf_key_size_type m_subject_var,
+                     m_object_var;
+    lf_predicate_stats m_stats;
+};
+
+struct lf_plan {
+    /* m_depth[v] is the depth of variable v; m_depth[0] is unused */
+    std::vector<lf_key_size_type> m_depth;
+    double m_cost;
+};
+
+/*
+ * Picks the variable order of a leapfrog join with the least estimated cost
+ * by dynamic programming over the sets of bound variables. The number of
+ * bindings of a set of variables is estimated assuming independence over a
+ * domain of the given size. Binding one more variable costs, per binding of
+ * the previous ones, the length of the shortest list it is intersected over:
+ * the distinct keys of an atom whose other variable is unbound, or the
+ * expected degree of the bound key otherwise.
+ * @param nvars the variables are 1 to nvars and each is in some atom
+ * @param nfirst variables 1 to nfirst get the first depths, in some order
+ */
+inline lf_plan lf_optimize_order(const std::vector<lf_atom> &atoms,
+        lf_key_size_type nvars, double domain, lf_key_size_type nfirst = 0) {
+    const size_t nsets = size_t(1) << nvars;
+    const size_t first = (size_t(1) << nfirst) - 1;
+    auto in = [](size_t set, lf_key_size_type var) -> bool {
+        return var == 0 || ((set >> (var - 1)) & 1);
+    };
+
+    std::vector<double> bindings(nsets, 1.0);
+    for (size_t set = 0; set < nsets; ++set) {
+        for (lf_key_size_type var = 1; var <= nvars; ++var) {
+            if (in(set, var)) bindings[set] *= domain;
+        }
+        for (const lf_atom &atom: atoms) {
+            bool subject = in(set, atom.m_subject_var),
+                 object = in(set, atom.m_object_var);
+            if (subject && object) {
+                bindings[set] *= atom.m_stats.m_size / domain /
+                    (atom.m_subject_var == atom.m_object_var && atom.m_subject_var
+                     ? 1.0 : domain);
+            } else if (subject) {
+                bindings[set] *= atom.m_stats.m_subject.m_distinct / domain;
+            } else if (object) {
+                bindings[set] *= atom.m_stats.m_object.m_distinct / domain;
+            }
+        }
+    }
+
+    std::vector<double> cost(nsets, std::numeric_limits<double>::infinity());
+    std::vector<lf_key_size_type> last(nsets, 0);
+    cost[0] = 0.0;
+    for (size_t set = 0; set < nsets; ++set) {
+        if (cost[set] == std::numeric_limits<double>::infinity()) continue;
+        for (lf_key_size_type var = 1; var <= nvars; ++var) {
+            if (in(set, var)) continue;
+            if (var > nfirst && (set & first) != first) continue;
+            double work = std::numeric_limits<double>::infinity();
+            for (const lf_atom &atom: atoms) {
+                double size = std::max<double>(atom.m_stats.m_size, 1.0);
+                if (atom.m_subject_var == var) {
+                    work = std::min(work, in(set, atom.m_object_var)
+                            ? atom.m_stats.m_object.m_degree_sq / size
+                            : (double) atom.m_stats.m_subject.m_distinct);
+                }
+                if (atom.m_object_var == var) {
+                    work = std::min(work, in(set, atom.m_subject_var)
+                            ? atom.m_stats.m_subject.m_degree_sq / size
+                            : (double) atom.m_stats.m_object.m_distinct);
+                }
+            }
+            size_t next = set | (size_t(1) << (var - 1));
+            double c = cost[set] + bindings[set] * work + bindings[next];
+            if (c < cost[next]) {
+                cost[next] = c;
+                last[next] = var;
+            }
+        }
+    }
+
+    lf_plan plan;
+    plan.m_depth.resize(nvars + 1, 0);
+    plan.m_cost = cost[nsets - 1];
+    for (size_t set = nsets - 1, depth = nvars; set; --depth) {
+        plan.m_depth[last[set]] = depth;
+        set &= ~(size_t(1) << (last[set] - 1));
+    }
+    return plan;
+}
+
+#endif
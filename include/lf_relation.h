@@ -0,0 +1,400 @@
+#ifndef LF_RELATION_H
+#define LF_RELATION_H
+
+#include "common.h"
+#include "lf_intersect.h"
+#include <tpie/btree.h>
+#include <tpie/file_stream.h>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <array>
+using std::uint8_t;
+
+typedef std::uint8_t lf_key_size_type;
+
+/* a row of a relation with N columns; binary relations keep value_type,
+ * which is what the .dat files hold */
+template <size_t N>
+struct lf_value_of {
+    typedef std::array<attr_type, N> type;
+};
+
+template <>
+struct lf_value_of<2> {
+    typedef value_type type;
+};
+
+/* the i-th column of a row */
+template <typename V>
+inline attr_type lf_key(const V &v, size_t i) {
+    return reinterpret_cast<const attr_type *>(&v)[i];
+}
+
+template <typename V>
+inline attr_type &lf_key(V &v, size_t i) {
+    return reinterpret_cast<attr_type *>(&v)[i];
+}
+
+/* lexicographic order of rows with N columns */
+template <size_t N>
+struct lf_key_comparator {
+    template <typename V>
+    bool operator()(const V &l, const V &r) const noexcept {
+        for (size_t i = 0; i + 1 < N; ++i) {
+            if (lf_key(l, i) != lf_key(r, i)) return lf_key(l, i) < lf_key(r, i);
+        }
+        return lf_key(l, N - 1) < lf_key(r, N - 1);
+    }
+};
+
+/*
+ * A relation is a sorted set of rows of type tuple_type, with arity columns,
+ * that lf_join walks with cursors. Cursors are plain values; a relation
+ * provides
+ *
+ *   cursor begin() const;
+ *   bool at_end(const cursor &c) const;
+ *   tuple_type get(const cursor &c) const;
+ *   attr_type key(const cursor &c, lf_key_size_type key_id) const;
+ *   void lower_bound_from(cursor &c, const tuple_type &v) const;
+ *      moves c forward to the first row not less than v
+ *   mark get_mark(const cursor &c) const;
+ *   void restore(cursor &c, const mark &m, const tuple_type &v) const;
+ *      moves c back to the mark m, taken while c was at the row v
+ *   attr_type last_key(const cursor &c, const tuple_type &prefix,
+ *                      lf_key_size_type key_id) const;
+ *      the last key_id-th key among the values starting with the first
+ *      key_id keys of prefix; c is positioned within that prefix
+ *   bool key_run(const cursor &c, lf_key_size_type key_id, lf_run &run) const;
+ *      the key_id-th keys from c to the end of its prefix if they are
+ *      stored contiguously, false otherwise
+ *   bool count_keys(const cursor &c, const tuple_type &prefix,
+ *                   lf_key_size_type key_id, size_t &n) const;
+ *      sets n to the number of key_id-th keys from c to the end of the
+ *      prefix without visiting them, or returns false if it cannot
+ *   std::vector<attr_type> sample_keys(size_t n) const;
+ *      about n distinct first keys that split the rows evenly
+ *   bool same_block(const cursor &a, const cursor &b,
+ *                   lf_key_size_type key_id) const;
+ *      whether moving between a and b stays within one block of storage
+ *      of the key_id-th keys, for the statistics of lf_join
+ *   size_t size() const;
+ */
+
+/* btree augmentation: the number of values in a subtree */
+struct lf_count_augment {
+    size_t m_count;
+};
+
+struct lf_count_augmenter {
+    template <typename N>
+    lf_count_augment operator()(const N &node) {
+        if (node.is_leaf()) return lf_count_augment{node.count()};
+        size_t n = 0;
+        for (size_t i = 0; i < node.count(); ++i) {
+            n += node.get_augmentation(i).m_count;
+        }
+        return lf_count_augment{n};
+    }
+};
+
+/* relation with N columns stored in a tpie::btree */
+template <size_t N, typename ...T>
+struct lf_btree_relation {
+    typedef typename lf_value_of<N>::type tuple_type;
+    typedef tpie::btree<tuple_type, tpie::btree_comp<lf_key_comparator<N>>,
+            tpie::btree_augment<lf_count_augmenter>, T...> btree_type;
+    typedef typename btree_type::iterator cursor;
+    /* a position in a leaf, which unlike a cursor holds no path */
+    typedef typename cursor::mark mark;
+
+    static constexpr size_t arity = N;
+    static constexpr bool is_internal = btree_type::is_internal;
+    static_assert(sizeof(tuple_type) == N * sizeof(attr_type), "Rows must be arrays of keys");
+
+    btree_type m_btree;
+    /* the btree is never modified once loaded */
+    cursor m_end;
+
+    /* assuming that the file is sorted */
+    explicit lf_btree_relation(tpie::file_stream<tuple_type> &in)
+        : lf_btree_relation(build(in, tpie::btree_builder<tuple_type,
+                    tpie::btree_comp<lf_key_comparator<N>>,
+                    tpie::btree_augment<lf_count_augmenter>, T...>())) {}
+
+    lf_btree_relation(tpie::file_stream<tuple_type> &in, std::string path)
+        : lf_btree_relation(build(in, tpie::btree_builder<tuple_type,
+                    tpie::btree_comp<lf_key_comparator<N>>,
+                    tpie::btree_augment<lf_count_augmenter>, T...>(path))) {}
+
+    explicit lf_btree_relation(btree_type &&btree)
+        : m_btree(std::move(btree)), m_end(m_btree.end()) {}
+
+    lf_btree_relation(lf_btree_relation &&o)
+        : m_btree(std::move(o.m_btree)), m_end(m_btree.end()) {}
+
+    size_t size() const { return m_btree.size(); }
+
+    cursor begin() const { return m_btree.begin(); }
+
+    bool at_end(const cursor &c) const { return c == m_end; }
+
+    tuple_type get(const cursor &c) const { return *c; }
+
+    attr_type key(const cursor &c, lf_key_size_type key_id) const {
+        return lf_key(*c, key_id);
+    }
+
+    void lower_bound_from(cursor &c, const tuple_type &v) const {
+        m_btree.lower_bound_from(c, v);
+    }
+
+    mark get_mark(const cursor &c) const { return c.get_mark(); }
+
+    /* a cursor that has left the leaf of m searches for v from the root */
+    void restore(cursor &c, const mark &m, const tuple_type &v) const {
+        if (!c.restore_mark(m)) c = m_btree.lower_bound(v);
+    }
+
+    attr_type last_key(const cursor &, const tuple_type &prefix,
+            lf_key_size_type key_id) const {
+        cursor iter = prefix_end(prefix, key_id);
+        --iter;
+        return key(iter, key_id);
+    }
+
+    /* rows are distinct, so the last keys under a prefix are counted by
+     * the ranks of its ends */
+    bool count_keys(const cursor &c, const tuple_type &prefix,
+            lf_key_size_type key_id, size_t &n) const {
+        if (key_id + 1 != N) return false;
+        n = at_end(c) ? 0 : rank(prefix_end(prefix, key_id)) - rank(c);
+        return true;
+    }
+
+    /* btree leaves hold whole values, so there are no runs of keys, and
+     * joins over btrees never take the kernels of lf_intersect.h */
+    bool key_run(const cursor &, lf_key_size_type, lf_run &) const {
+        return false;
+    }
+
+    bool same_block(const cursor &a, const cursor &b, lf_key_size_type) const {
+        return a.same_leaf(b);
+    }
+
+    /* the min keys of the btree nodes on the first level with at least n
+     * children */
+    std::vector<attr_type> sample_keys(size_t n) const {
+        std::vector<attr_type> keys;
+        if (m_btree.empty()) return keys;
+        std::vector<typename btree_type::node_type> level(1, m_btree.root());
+        for (;;) {
+            size_t nchildren = 0;
+            for (const auto &node: level) nchildren += node.count();
+            if (nchildren >= n || level.front().is_leaf()) {
+                for (const auto &node: level) {
+                    for (size_t i = 0; i < node.count(); ++i) {
+                        if (keys.empty() || keys.back() != lf_key(node.min_key(i), 0))
+                            keys.push_back(lf_key(node.min_key(i), 0));
+                    }
+                }
+                return keys;
+            }
+            std::vector<typename btree_type::node_type> next_level;
+            for (const auto &node: level) {
+                for (size_t i = 0; i < node.count(); ++i) {
+                    next_level.push_back(node.get_child(i));
+                }
+            }
+            level.swap(next_level);
+        }
+    }
+
+private:
+    /* @returns the first row after those starting with the first key_id
+     * keys of prefix */
+    cursor prefix_end(const tuple_type &prefix, lf_key_size_type key_id) const {
+        if (key_id == 0) return m_end;
+        tuple_type upper = prefix;
+        ++lf_key(upper, key_id - 1);
+        for (size_t i = key_id; i < N; ++i) {
+            lf_key(upper, i) = 0;
+        }
+        return m_btree.lower_bound(upper);
+    }
+
+    /* @returns the number of rows before c */
+    size_t rank(const cursor &c) const {
+        typename btree_type::node_type node = c.get_leaf();
+        size_t r = c.index();
+        while (node.has_parent()) {
+            size_t index = node.index();
+            node.parent();
+            for (size_t i = 0; i < index; ++i) {
+                r += node.get_augmentation(i).m_count;
+            }
+        }
+        return r;
+    }
+
+    template <typename B>
+    static btree_type build(tpie::file_stream<tuple_type> &in, B &&builder) {
+        while (in.can_read()) {
+            builder.push(in.read());
+        }
+        return builder.build();
+    }
+};
+
+/* Tag for lf_join to store its relations in lf_trie_relations */
+struct lf_flat_trie {};
+
+/*
+ * Static relation stored as a two-level trie of sorted arrays: m_keys1 holds
+ * the distinct first keys and the second keys of m_keys1[i] are
+ * m_keys2[m_offsets[i]] to m_keys2[m_offsets[i + 1] - 1].
+ */
+struct lf_trie_relation {
+    struct cursor {
+        size_t m_i1, m_i2;
+
+        bool operator==(const cursor &o) const {
+            return m_i1 == o.m_i1 && m_i2 == o.m_i2;
+        }
+    };
+    typedef cursor mark;
+
+    typedef value_type tuple_type;
+
+    static constexpr size_t arity = 2;
+    static constexpr bool is_internal = true;
+
+    std::vector<attr_type> m_keys1;
+    std::vector<size_t> m_offsets;
+    std::vector<attr_type> m_keys2;
+
+    /* assuming that the file is sorted */
+    explicit lf_trie_relation(tpie::file_stream<value_type> &in) {
+        m_keys2.reserve(in.size() - in.offset());
+        while (in.can_read()) {
+            const value_type &v = in.read();
+            if (m_keys1.empty() || m_keys1.back() != v.key1) {
+                m_keys1.push_back(v.key1);
+                m_offsets.push_back(m_keys2.size());
+            }
+            m_keys2.push_back(v.key2);
+        }
+        m_offsets.push_back(m_keys2.size());
+        m_keys1.shrink_to_fit();
+        m_offsets.shrink_to_fit();
+    }
+
+    size_t size() const { return m_keys2.size(); }
+
+    cursor begin() const { return cursor{0, 0}; }
+
+    bool at_end(const cursor &c) const { return c.m_i1 == m_keys1.size(); }
+
+    value_type get(const cursor &c) const {
+        return value_type{m_keys1[c.m_i1], m_keys2[c.m_i2]};
+    }
+
+    attr_type key(const cursor &c, lf_key_size_type key_id) const {
+        return key_id ? m_keys2[c.m_i2] : m_keys1[c.m_i1];
+    }
+
+    void lower_bound_from(cursor &c, const value_type &v) const {
+        if (at_end(c)) return ;
+        if (m_keys1[c.m_i1] < v.key1) {
+            c.m_i1 = lf_gallop(m_keys1.data(), c.m_i1 + 1, m_keys1.size(), v.key1);
+            c.m_i2 = m_offsets[c.m_i1];
+            if (at_end(c) || m_keys1[c.m_i1] != v.key1) return ;
+        } else if (m_keys1[c.m_i1] != v.key1) {
+            return ;
+        }
+        size_t end = m_offsets[c.m_i1 + 1];
+        c.m_i2 = lf_gallop(m_keys2.data(), c.m_i2, end, v.key2);
+        if (c.m_i2 == end) ++c.m_i1;
+    }
+
+    mark get_mark(const cursor &c) const { return c; }
+
+    void restore(cursor &c, const mark &m, const value_type &) const { c = m; }
+
+    attr_type last_key(const cursor &c, const value_type &,
+            lf_key_size_type key_id) const {
+        if (key_id == 0) return m_keys1.back();
+        return m_keys2[m_offsets[c.m_i1 + 1] - 1];
+    }
+
+    bool count_keys(const cursor &c, const value_type &,
+            lf_key_size_type key_id, size_t &n) const {
+        if (at_end(c)) {
+            n = 0;
+        } else if (key_id == 0) {
+            n = m_keys1.size() - c.m_i1;
+        } else {
+            n = m_offsets[c.m_i1 + 1] - c.m_i2;
+        }
+        return true;
+    }
+
+    bool key_run(const cursor &c, lf_key_size_type key_id, lf_run &run) const {
+        if (at_end(c)) {
+            run = lf_run{nullptr, nullptr};
+        } else if (key_id == 0) {
+            run = lf_run{m_keys1.data() + c.m_i1, m_keys1.data() + m_keys1.size()};
+        } else {
+            run = lf_run{m_keys2.data() + c.m_i2, m_keys2.data() + m_offsets[c.m_i1 + 1]};
+        }
+        return true;
+    }
+
+    /* the blocks are cache lines of the arrays of keys */
+    bool same_block(const cursor &a, const cursor &b, lf_key_size_type key_id) const {
+        const attr_type *keys = key_id ? m_keys2.data() : m_keys1.data();
+        size_t ia = key_id ? a.m_i2 : a.m_i1,
+               ib = key_id ? b.m_i2 : b.m_i1;
+        return reinterpret_cast<uintptr_t>(keys + ia) / 64 ==
+            reinterpret_cast<uintptr_t>(keys + ib) / 64;
+    }
+
+    /* the first keys at which the second-level offsets cross multiples
+     * of size() / n */
+    std::vector<attr_type> sample_keys(size_t n) const {
+        std::vector<attr_type> keys;
+        if (m_keys1.empty()) return keys;
+        for (size_t i = 0; i < n; ++i) {
+            size_t i1 = std::upper_bound(m_offsets.begin(), m_offsets.end() - 1,
+                    i * size() / n) - m_offsets.begin() - 1;
+            if (keys.empty() || keys.back() != m_keys1[i1])
+                keys.push_back(m_keys1[i1]);
+        }
+        return keys;
+    }
+};
+
+/* Tag for lf_join to join relations with N columns, given before the btree
+ * options; the relations are binary otherwise */
+template <size_t N>
+struct lf_arity {};
+
+template <typename ...T>
+struct lf_relation_of {
+    typedef lf_btree_relation<2, T...> type;
+};
+
+template <size_t N, typename ...T>
+struct lf_relation_of<lf_arity<N>, T...> {
+    typedef lf_btree_relation<N, T...> type;
+};
+
+template <>
+struct lf_relation_of<lf_flat_trie> {
+    typedef lf_trie_relation type;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef LF_SEMIJOIN_H
+#define LF_SEMIJOIN_H
+
+#include "common.h"
+#include "lf_relation.h"
+#include "lf_optimizer.h"
+#include <tpie/file_stream.h>
+#include <tpie/memory.h>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+
+/*
+ * Semi-join reduction of the inputs of a join of binary atoms before their
+ * btrees are built. Every variable gets a domain, the values that some
+ * tuple of every atom over it still has, and the atoms are scanned over
+ * and over, dropping the tuples with a value out of a domain and
+ * narrowing the domains to the values of the tuples left, until a scan
+ * drops nothing. The result is a sound filter rather than a full reducer
+ * like that of Yannakakis, even for acyclic queries: no tuple of a result
+ * is dropped, but a domain only holds values, not pairs of them, so tuples
+ * of atoms that share both of their variables can be left dangling.
+ *
+ * The files are only read in order. The domains are bitmaps over the
+ * dictionary, so a tuple is checked on both of its columns whatever the
+ * file is sorted by, and the reduced files keep that order.
+ */
+
+/* a set of dictionary ids */
+class lf_domain {
+public:
+    lf_domain(size_t size, bool full)
+        : m_words((size + 63) / 64, full ? ~(uint64_t) 0 : 0) {}
+
+    bool contains(attr_type v) const {
+        return (m_words[v / 64] >> (v % 64)) & 1;
+    }
+
+    void insert(attr_type v) {
+        m_words[v / 64] |= uint64_t(1) << (v % 64);
+    }
+
+    /* keeps the ids that are also in o */
+    void intersect(const lf_domain &o) {
+        for (size_t i = 0; i < m_words.size(); ++i) m_words[i] &= o.m_words[i];
+    }
+
+    /* @returns the bytes of a domain of size ids */
+    static size_t bytes(size_t size) {
+        return (size + 63) / 64 * sizeof(uint64_t);
+    }
+
+private:
+    std::vector<uint64_t, tpie::allocator<uint64_t>> m_words;
+};
+
+/* an atom to reduce, the variables being numbered from 1 and 0 standing
+ * for the constant next to it */
+struct lf_semijoin_atom {
+    /* the tuples of the predicate, sorted by subject */
+    std::string m_path;
+    lf_key_size_type m_subject_var, m_object_var;
+    attr_type m_subject, m_object;
+};
+
+/* the domains of the variables of a query, index 0 being unused */
+typedef std::vector<lf_domain> lf_domains;
+
+/* @returns whether the domains leave (s, o) in the atom */
+inline bool lf_semijoin_keeps(const lf_domains &domains, lf_key_size_type subject_var,
+        lf_key_size_type object_var, attr_type subject, attr_type object,
+        attr_type s, attr_type o) {
+    if (subject_var ? !domains[subject_var].contains(s) : s != subject) return false;
+    if (object_var ? !domains[object_var].contains(o) : o != object) return false;
+    return subject_var != object_var || !subject_var || s == o;
+}
+
+/*
+ * Guesses from the degree statistics of the atoms whether reducing them
+ * drops at least the given fraction of their tuples. A variable is
+ * guessed to keep as many values as the atom over it with the fewest
+ * distinct ones, or the fewest values next to a constant, and an atom to
+ * keep its tuples in proportion to the values its columns keep.
+ */
+inline bool lf_semijoin_pays(const std::vector<lf_atom> &atoms, lf_key_size_type nvars,
+        double min_reduction = 0.5) {
+    auto distinct = [](const lf_atom &atom, bool subject) -> double {
+        const lf_side_stats &side = subject ? atom.m_stats.m_subject : atom.m_stats.m_object;
+        const lf_side_stats &other = subject ? atom.m_stats.m_object : atom.m_stats.m_subject;
+        double n = std::max<double>(side.m_distinct, 1.0);
+        /* the values next to one constant, on average */
+        if ((subject ? atom.m_object_var : atom.m_subject_var) == 0) {
+            n = std::min(n, std::max(1.0,
+                        (double) atom.m_stats.m_size / std::max<double>(other.m_distinct, 1.0)));
+        }
+        return n;
+    };
+    std::vector<double> kept(nvars + 1, std::numeric_limits<double>::infinity());
+    for (const lf_atom &atom: atoms) {
+        if (atom.m_subject_var) {
+            kept[atom.m_subject_var] = std::min(kept[atom.m_subject_var], distinct(atom, true));
+        }
+        if (atom.m_object_var) {
+            kept[atom.m_object_var] = std::min(kept[atom.m_object_var], distinct(atom, false));
+        }
+    }
+    double size = 0, left = 0;
+    for (const lf_atom &atom: atoms) {
+        double n = atom.m_stats.m_size;
+        size += n;
+        if (atom.m_subject_var) {
+            n *= kept[atom.m_subject_var] / std::max<double>(atom.m_stats.m_subject.m_distinct, 1.0);
+        } else {
+            n /= std::max<double>(atom.m_stats.m_subject.m_distinct, 1.0);
+        }
+        if (atom.m_object_var) {
+            n *= kept[atom.m_object_var] / std::max<double>(atom.m_stats.m_object.m_distinct, 1.0);
+        } else {
+            n /= std::max<double>(atom.m_stats.m_object.m_distinct, 1.0);
+        }
+        left += n;
+    }
+    return size > 0 && left <= (1 - min_reduction) * size;
+}
+
+/*
+ * Narrows the domains of the variables until every atom keeps all its
+ * tuples left, scanning the atoms in turn and narrowing the domains of
+ * an atom's variables right after scanning it.
+ * @param domain_size the number of dictionary ids
+ * @param max_rounds the most scans of every atom
+ * @returns the domains, index 0 being unused */
+inline lf_domains lf_semijoin_reduce(const std::vector<lf_semijoin_atom> &atoms,
+        lf_key_size_type nvars, size_t domain_size, size_t max_rounds) {
+    lf_domains domains(nvars + 1, lf_domain(0, true));
+    for (lf_key_size_type var = 1; var <= nvars; ++var) {
+        domains[var] = lf_domain(domain_size, true);
+    }
+    /* the tuples each atom kept in the last round */
+    std::vector<uint64_t> kept(atoms.size(), ~(uint64_t) 0);
+    for (size_t round = 0; round < max_rounds; ++round) {
+        bool dropped = false;
+        for (size_t i = 0; i < atoms.size(); ++i) {
+            const lf_semijoin_atom &atom = atoms[i];
+            lf_domain subjects(domain_size, false), objects(domain_size, false);
+            uint64_t n = 0;
+            tpie::file_stream<value_type> in;
+            in.open(atom.m_path, tpie::access_read);
+            while (in.can_read()) {
+                const value_type &v = in.read();
+                if (!lf_semijoin_keeps(domains, atom.m_subject_var, atom.m_object_var,
+                            atom.m_subject, atom.m_object, v.key1, v.key2))
+                    continue;
+                subjects.insert(v.key1);
+                objects.insert(v.key2);
+                ++n;
+            }
+            if (atom.m_subject_var) domains[atom.m_subject_var].intersect(subjects);
+            if (atom.m_object_var) domains[atom.m_object_var].intersect(objects);
+            dropped |= n != kept[i];
+            kept[i] = n;
+        }
+        if (!dropped) break;
+    }
+    return domains;
+}
+
+/* copies the tuples of in that the domains leave in the atom to out,
+ * in their order; swapped if in holds (object, subject) tuples */
+inline void lf_semijoin_filter(tpie::file_stream<value_type> &in,
+        tpie::file_stream<value_type> &out, const lf_domains &domains,
+        const lf_semijoin_atom &atom, bool swapped) {
+    while (in.can_read()) {
+        const value_type &v = in.read();
+        attr_type s = swapped ? v.key2 : v.key1,
+                  o = swapped ? v.key1 : v.key2;
+        if (lf_semijoin_keeps(domains, atom.m_subject_var, atom.m_object_var,
+                    atom.m_subject, atom.m_object, s, o)) {
+            out.write(v);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef LF_STATIC_JOIN_H
+#define LF_STATIC_JOIN_H
+
+#include "leapfrog.h"
+#include <array>
+#include <vector>
+#include <type_traits>
+
+/*
+ * The shape of a static join is the set of edges (a, b), a < b, between the
+ * depths a and b whose keys a relation binds, numbered in lexicographic
+ * order and given as a bit mask. The relations of the join are in the
+ * order of their edges, and these functions find at compile time which
+ * ones bind a key at each depth.
+ */
+
+/* @returns the number of edges between nvars depths */
+constexpr size_t lf_static_nedges(size_t nvars) {
+    return nvars * (nvars - 1) / 2;
+}
+
+/* @returns the number of edge (a, b) */
+constexpr size_t lf_static_edge(size_t nvars, size_t a, size_t b) {
+    return (a - 1) * nvars - a * (a - 1) / 2 + (b - a - 1);
+}
+
+/* @returns a, or b if second, of edge e */
+constexpr size_t lf_static_edge_depth(size_t nvars, size_t e, bool second) {
+    for (size_t a = 1; a <= nvars; ++a) {
+        for (size_t b = a + 1; b <= nvars; ++b) {
+            if (e-- == 0) return second ? b : a;
+        }
+    }
+    return 0;
+}
+
+constexpr size_t lf_static_popcount(unsigned edges) {
+    size_t n = 0;
+    for (; edges; edges &= edges - 1) ++n;
+    return n;
+}
+
+/* @returns the number of relations of edges whose first key, or second
+ * key if second, is bound at depth d */
+constexpr size_t lf_static_degree(size_t nvars, unsigned edges, bool second, size_t d) {
+    size_t n = 0;
+    for (size_t e = 0; e < lf_static_nedges(nvars); ++e) {
+        if ((edges >> e & 1) && lf_static_edge_depth(nvars, e, second) == d) ++n;
+    }
+    return n;
+}
+
+/* @returns the i-th of the relations of lf_static_degree() */
+constexpr size_t lf_static_relation(size_t nvars, unsigned edges, bool second, size_t d, size_t i) {
+    size_t r = 0;
+    for (size_t e = 0; e < lf_static_nedges(nvars); ++e) {
+        if (!(edges >> e & 1)) continue;
+        if (lf_static_edge_depth(nvars, e, second) == d && i-- == 0) return r;
+        ++r;
+    }
+    return r;
+}
+
+/* @returns whether edges is a shape that lf_static_join_run() tries: nvars
+ * - 1 or nvars edges that bind every depth */
+constexpr bool lf_static_shape(size_t nvars, unsigned edges) {
+    const size_t n = lf_static_popcount(edges);
+    if (n + 1 != nvars && n != nvars) return false;
+    for (size_t d = 1; d <= nvars; ++d) {
+        if (!lf_static_degree(nvars, edges, false, d) && !lf_static_degree(nvars, edges, true, d))
+            return false;
+    }
+    return true;
+}
+
+/* calls f(std::integral_constant<size_t, I>()) for I from I to N - 1
+ * while it returns true
+ * @returns false if it returned false */
+template <size_t I, size_t N>
+struct lf_unroll {
+    template <typename F>
+    static bool run(F &f) {
+        return f(std::integral_constant<size_t, I>()) && lf_unroll<I + 1, N>::run(f);
+    }
+};
+
+template <size_t N>
+struct lf_unroll<N, N> {
+    template <typename F>
+    static bool run(F &) { return true; }
+};
+
+/*
+ * Leapfrog join of binary relations over NVARS variables in the shape
+ * EDGES, for the small queries we run over and over. The depths are
+ * unrolled at compile time into nested loops, and so are the loops over
+ * the relations of a depth, whose number and order are constants. The
+ * relations are borrowed from an lf_join that has loaded them, which
+ * remains the general (and parallel) path.
+ */
+template <size_t NVARS, unsigned EDGES, typename ...T>
+class lf_static_join {
+public:
+    static constexpr size_t NRELS = lf_static_popcount(EDGES);
+    typedef lf_join<T...> join_type;
+    typedef typename join_type::relation_type relation_type;
+    typedef typename relation_type::cursor cursor_type;
+    typedef typename relation_type::mark mark_type;
+    typedef typename relation_type::tuple_type tuple_type;
+    static_assert(join_type::arity == 2, "Static joins are over binary relations");
+
+    /* @returns whether join has NVARS variables, all of them output, no
+     * grouping, limit, cancel token or cache, and a relation for every edge
+     * of EDGES and no other */
+    static bool fits(const join_type &join) {
+        if (join.m_relations.size() != NRELS || join.nvars() != NVARS) return false;
+        if (join.m_project_depth && join.m_project_depth < NVARS) return false;
+        if (join.m_group_depth || join.m_limit || join.m_cancel_token ||
+                join.m_cache_bytes) return false;
+        unsigned edges = 0;
+        for (const auto &keyinfo: join.m_keyinfo) {
+            if (keyinfo[0] == 0 || keyinfo[0] >= keyinfo[1]) return false;
+            edges |= 1u << lf_static_edge(NVARS, keyinfo[0], keyinfo[1]);
+        }
+        return edges == EDGES;
+    }
+
+    explicit lf_static_join(const join_type &join): m_count(0), m_output(nullptr) {
+        tp_assert(fits(join), "Join does not fit the static join");
+        for (size_t i = 0; i < NRELS; ++i) {
+            size_t e = lf_static_edge(NVARS, join.m_keyinfo[i][0], join.m_keyinfo[i][1]);
+            m_rels[lf_static_popcount(EDGES & ((1u << e) - 1))] = &join.m_relations[i];
+        }
+    }
+
+    uint64_t join_count() {
+        return run(nullptr);
+    }
+
+    uint64_t join(lf_output &output) {
+        return run(&output);
+    }
+
+    template <typename F>
+    uint64_t join_visit(F f) {
+        lf_visitor_output<F> output(std::move(f));
+        return run(&output);
+    }
+
+private:
+    uint64_t run(lf_output *output) {
+        m_count = 0;
+        m_output = output;
+        join_depth<1>();
+        flush();
+        return m_count;
+    }
+
+    template <lf_key_size_type KEY_ID>
+    attr_type key_of(size_t r) const {
+        return m_rels[r]->key(m_cursor[r], KEY_ID);
+    }
+
+    /* calls f(std::integral_constant<size_t, R>()) on the relations R whose
+     * first key, or second key if SECOND, is bound at depth D while it
+     * returns true
+     * @returns false if it returned false */
+    template <size_t D, bool SECOND, typename F>
+    static bool each(F f) {
+        auto g = [&f](auto i) {
+            return f(std::integral_constant<size_t,
+                    lf_static_relation(NVARS, EDGES, SECOND, D, decltype(i)::value)>());
+        };
+        return lf_unroll<0, lf_static_degree(NVARS, EDGES, SECOND, D)>::run(g);
+    }
+
+    /* relations whose first key is bound at depth D start over; the others
+     * are under the prefix their parent depth bound */
+    template <size_t D>
+    void open() {
+        each<D, false>([this](auto r) {
+            m_cursor[r] = m_rels[r]->begin();
+            return true;
+        });
+        each<D, true>([this](auto r) {
+            m_open[r] = m_rels[r]->get_mark(m_cursor[r]);
+            m_open_value[r] = m_rels[r]->get(m_cursor[r]);
+            m_prefix[r] = key_of<0>(r);
+            return true;
+        });
+    }
+
+    template <size_t D>
+    void up() {
+        each<D, true>([this](auto r) {
+            m_rels[r]->restore(m_cursor[r], m_open[r], m_open_value[r]);
+            return true;
+        });
+    }
+
+    /* Seeks every iterator of depth D to the least key not less than key
+     * that they all have, sweeping over them until none of them moves past
+     * the others.
+     * @returns false if some iterator runs out of keys */
+    template <size_t D>
+    bool align(attr_type &key) {
+        for (;;) {
+            bool agreed = true, found = true;
+            found = each<D, false>([&](auto r) {
+                m_rels[r]->lower_bound_from(m_cursor[r], value_type{key, 0});
+                if (m_rels[r]->at_end(m_cursor[r])) return false;
+                attr_type k = key_of<0>(r);
+                if (k != key) {
+                    key = k;
+                    agreed = false;
+                }
+                return true;
+            }) && each<D, true>([&](auto r) {
+                m_rels[r]->lower_bound_from(m_cursor[r], value_type{m_prefix[r], key});
+                if (m_rels[r]->at_end(m_cursor[r]) || key_of<0>(r) != m_prefix[r])
+                    return false;
+                attr_type k = key_of<1>(r);
+                if (k != key) {
+                    key = k;
+                    agreed = false;
+                }
+                return true;
+            });
+            if (!found) return false;
+            if (agreed) return true;
+        }
+    }
+
+    template <size_t D>
+    void join_depth() {
+        open<D>();
+        bind<D>(std::integral_constant<bool, D == NVARS>());
+        up<D>();
+    }
+
+    template <size_t D>
+    void bind(std::false_type) {
+        for (attr_type key = 0; align<D>(key); ++key) {
+            m_bind[D - 1] = key;
+            join_depth<D + 1>();
+        }
+    }
+
+    /* the last depth only has relations under a prefix; count or intersect
+     * their keys at once when they allow it */
+    template <size_t D>
+    void bind(std::true_type) {
+        constexpr size_t k = lf_static_degree(NVARS, EDGES, true, D);
+        if (!m_output && k == 1) {
+            constexpr size_t r = lf_static_relation(NVARS, EDGES, true, D, 0);
+            size_t n;
+            if (m_rels[r]->count_keys(m_cursor[r], value_type{m_prefix[r], 0}, 1, n)) {
+                m_count += n;
+                return ;
+            }
+        }
+        size_t i = 0;
+        const bool runs = each<D, true>([&](auto r) {
+            return m_rels[r]->key_run(m_cursor[r], 1, m_runs[i++]);
+        });
+        if (runs) {
+            const attr_type *keys = nullptr;
+            size_t n = lf_intersect_runs(m_runs.data(), k, m_buffers, !m_output, keys);
+            m_count += n;
+            if (m_output) {
+                for (size_t i = 0; i < n; ++i) emit(keys[i]);
+            }
+            return ;
+        }
+        for (attr_type key = 0; align<D>(key); ++key) {
+            ++m_count;
+            if (m_output) emit(key);
+        }
+    }
+
+    void emit(attr_type key) {
+        m_results.insert(m_results.end(), m_bind.begin(), m_bind.end() - 1);
+        m_results.push_back(key);
+        if (m_results.size() >= join_type::output_batch_size * NVARS) flush();
+    }
+
+    void flush() {
+        if (!m_output || m_results.empty()) return ;
+        m_output->write(m_results.data(), m_results.size() / NVARS, NVARS);
+        m_results.clear();
+    }
+
+    std::array<const relation_type *, NRELS> m_rels;
+    /* one cursor per relation, shared by the depths of its two keys */
+    std::array<cursor_type, NRELS> m_cursor;
+    /* where open() found the cursor of a relation, and the row there */
+    std::array<mark_type, NRELS> m_open;
+    std::array<tuple_type, NRELS> m_open_value;
+    /* the first key of a relation while its second key is being bound */
+    std::array<attr_type, NRELS> m_prefix;
+    std::array<attr_type, NVARS> m_bind;
+    uint64_t m_count;
+    lf_output *m_output;
+    std::vector<attr_type> m_results;
+    std::array<lf_run, NRELS> m_runs;
+    std::vector<attr_type> m_buffers[2];
+};
+
+template <size_t NVARS, unsigned EDGES, typename ...T>
+bool lf_static_join_edges(const lf_join<T...> &, lf_output *, uint64_t &, std::false_type) {
+    return false;
+}
+
+/* runs join through an lf_static_join of shape EDGES if it fits */
+template <size_t NVARS, unsigned EDGES, typename ...T>
+bool lf_static_join_edges(const lf_join<T...> &join, lf_output *output, uint64_t &count,
+        std::true_type) {
+    typedef lf_static_join<NVARS, EDGES, T...> static_join_type;
+    if (!static_join_type::fits(join)) return false;
+    static_join_type static_join(join);
+    count = output ? static_join.join(*output) : static_join.join_count();
+    return true;
+}
+
+template <size_t NVARS, unsigned EDGES, typename ...T>
+bool lf_static_join_shapes(const lf_join<T...> &, lf_output *, uint64_t &, std::false_type) {
+    return false;
+}
+
+/* tries the shapes over NVARS depths from EDGES on */
+template <size_t NVARS, unsigned EDGES, typename ...T>
+bool lf_static_join_shapes(const lf_join<T...> &join, lf_output *output, uint64_t &count,
+        std::true_type) {
+    return lf_static_join_edges<NVARS, EDGES>(join, output, count,
+            std::integral_constant<bool, lf_static_shape(NVARS, EDGES)>()) ||
+        lf_static_join_shapes<NVARS, EDGES + 1>(join, output, count,
+            std::integral_constant<bool, (EDGES + 1 < (1u << lf_static_nedges(NVARS)))>());
+}
+
+template <typename ...T>
+bool lf_static_join_run(const lf_join<T...> &join, lf_output *output, uint64_t &count,
+        std::true_type) {
+    switch (join.nvars()) {
+    case 2:
+        return lf_static_join_shapes<2, 1>(join, output, count, std::true_type());
+    case 3:
+        return lf_static_join_shapes<3, 1>(join, output, count, std::true_type());
+    case 4:
+        return lf_static_join_shapes<4, 1>(join, output, count, std::true_type());
+    default:
+        return false;
+    }
+}
+
+template <typename ...T>
+bool lf_static_join_run(const lf_join<T...> &, lf_output *, uint64_t &, std::false_type) {
+    return false;
+}
+
+/* Runs join through an lf_static_join if it has two to four variables and
+ * one relation less than variables or as many, e.g. an edge, a path of two
+ * or three edges, a triangle, a 3-star or a 4-cycle.
+ * @param output nullptr to only count
+ * @returns false, doing nothing, for other queries */
+template <typename ...T>
+bool lf_static_join_run(const lf_join<T...> &join, lf_output *output, uint64_t &count) {
+    return lf_static_join_run(join, output, count,
+            std::integral_constant<bool, lf_join<T...>::arity == 2>());
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef LF_STATS_H
+#define LF_STATS_H
+
+#include "lf_relation.h"
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <algorithm>
+
+/* Build with -DLF_STATS=1 for lf_join to count where its time goes. The
+ * counters are compiled out otherwise. */
+#ifndef LF_STATS
+#define LF_STATS 0
+#endif
+
+static constexpr bool lf_stats_enabled = LF_STATS;
+
+struct lf_depth_stats {
+    uint64_t m_seeks;
+    /* seeks that end in the block they start from, see same_block() in
+     * lf_relation.h */
+    uint64_t m_near_seeks;
+    uint64_t m_nexts;
+    uint64_t m_bindings;
+    /* returns to the depth above once the keys run out */
+    uint64_t m_backtracks;
+    /* last-depth fast paths: key ranges counted, intersections of key
+     * runs, the keys in the runs and the keys they have in common */
+    uint64_t m_counts;
+    uint64_t m_intersections;
+    uint64_t m_intersect_in;
+    uint64_t m_intersect_out;
+    /* subtrees under the depth counted from the cache, and looked up in
+     * it in vain, see lf_join::cache() */
+    uint64_t m_cache_hits;
+    uint64_t m_cache_misses;
+    /* time spent at the depth, not counting the deeper ones */
+    uint64_t m_time_ns;
+};
+
+struct lf_table_stats {
+    uint64_t m_seeks;
+    uint64_t m_near_seeks;
+    uint64_t m_nexts;
+};
+
+/* counters of a join, summed over the states of a parallel join */
+struct lf_join_stats {
+    typedef std::chrono::steady_clock clock;
+
+    std::vector<lf_depth_stats> m_depths;
+    std::vector<lf_table_stats> m_tables;
+    /* the last tick() */
+    clock::time_point m_tick;
+    lf_key_size_type m_tick_depth;
+
+    void reset(size_t ndepths, size_t ntables) {
+        m_depths.assign(ndepths, lf_depth_stats());
+        m_tables.assign(ntables, lf_table_stats());
+        m_tick = clock::now();
+        m_tick_depth = 0;
+    }
+
+    /* charges the time since the last tick to the depth it was at */
+    void tick(lf_key_size_type depth) {
+        clock::time_point now = clock::now();
+        m_depths[m_tick_depth].m_time_ns +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_tick).count();
+        m_tick = now;
+        m_tick_depth = depth;
+    }
+
+    void seek(lf_key_size_type depth, lf_key_size_type table_id, bool near) {
+        ++m_depths[depth].m_seeks;
+        ++m_tables[table_id].m_seeks;
+        m_depths[depth].m_near_seeks += near;
+        m_tables[table_id].m_near_seeks += near;
+    }
+
+    void next(lf_key_size_type depth, lf_key_size_type table_id) {
+        ++m_depths[depth].m_nexts;
+        ++m_tables[table_id].m_nexts;
+    }
+
+    void bind(lf_key_size_type depth) {
+        ++m_depths[depth].m_bindings;
+    }
+
+    void backtrack(lf_key_size_type depth) {
+        ++m_depths[depth].m_backtracks;
+    }
+
+    void count(lf_key_size_type depth) {
+        ++m_depths[depth].m_counts;
+    }
+
+    void intersect(lf_key_size_type depth, const lf_run *runs, size_t nruns, size_t n) {
+        lf_depth_stats &stats = m_depths[depth];
+        ++stats.m_intersections;
+        for (size_t i = 0; i < nruns; ++i) {
+            stats.m_intersect_in += runs[i].size();
+        }
+        stats.m_intersect_out += n;
+    }
+
+    void cache_hit(lf_key_size_type depth) {
+        ++m_depths[depth].m_cache_hits;
+    }
+
+    void cache_miss(lf_key_size_type depth) {
+        ++m_depths[depth].m_cache_misses;
+    }
+
+    void merge(const lf_join_stats &o) {
+        m_depths.resize(std::max(m_depths.size(), o.m_depths.size()), lf_depth_stats());
+        m_tables.resize(std::max(m_tables.size(), o.m_tables.size()), lf_table_stats());
+        for (size_t d = 0; d < o.m_depths.size(); ++d) {
+            lf_depth_stats &x = m_depths[d];
+            const lf_depth_stats &y = o.m_depths[d];
+            x.m_seeks += y.m_seeks;
+            x.m_near_seeks += y.m_near_seeks;
+            x.m_nexts += y.m_nexts;
+            x.m_bindings += y.m_bindings;
+            x.m_backtracks += y.m_backtracks;
+            x.m_counts += y.m_counts;
+            x.m_intersections += y.m_intersections;
+            x.m_intersect_in += y.m_intersect_in;
+            x.m_intersect_out += y.m_intersect_out;
+            x.m_cache_hits += y.m_cache_hits;
+            x.m_cache_misses += y.m_cache_misses;
+            x.m_time_ns += y.m_time_ns;
+        }
+        for (size_t t = 0; t < o.m_tables.size(); ++t) {
+            m_tables[t].m_seeks += o.m_tables[t].m_seeks;
+            m_tables[t].m_near_seeks += o.m_tables[t].m_near_seeks;
+            m_tables[t].m_nexts += o.m_tables[t].m_nexts;
+        }
+    }
+
+    /* writes {"depths": [...], "tables": [...]} on one line, depths from 1 */
+    void write_json(std::ostream &out) const {
+        out << "{\"depths\": [";
+        for (size_t d = 1; d < m_depths.size(); ++d) {
+            const lf_depth_stats &x = m_depths[d];
+            if (d > 1) out << ", ";
+            out << "{\"depth\": " << d
+                << ", \"seeks\": " << x.m_seeks
+                << ", \"near_seeks\": " << x.m_near_seeks
+                << ", \"nexts\": " << x.m_nexts
+                << ", \"bindings\": " << x.m_bindings
+                << ", \"backtracks\": " << x.m_backtracks
+                << ", \"counts\": " << x.m_counts
+                << ", \"intersections\": " << x.m_intersections
+                << ", \"intersect_in\": " << x.m_intersect_in
+                << ", \"intersect_out\": " << x.m_intersect_out
+                << ", \"cache_hits\": " << x.m_cache_hits
+                << ", \"cache_misses\": " << x.m_cache_misses
+                << ", \"time_ns\": " << x.m_time_ns << "}";
+        }
+        out << "], \"tables\": [";
+        for (size_t t = 0; t < m_tables.size(); ++t) {
+            const lf_table_stats &x = m_tables[t];
+            if (t > 0) out << ", ";
+            out << "{\"table\": " << t
+                << ", \"seeks\": " << x.m_seeks
+                << ", \"near_seeks\": " << x.m_near_seeks
+                << ", \"nexts\": " << x.m_nexts << "}";
+        }
+        out << "]}";
+    }
+};
+
+/* what lf_join keeps instead when the counters are compiled out */
+struct lf_no_stats {
+    void reset(size_t, size_t) {}
+    void tick(lf_key_size_type) {}
+    void seek(lf_key_size_type, lf_key_size_type, bool) {}
+    void next(lf_key_size_type, lf_key_size_type) {}
+    void bind(lf_key_size_type) {}
+    void backtrack(lf_key_size_type) {}
+    void count(lf_key_size_type) {}
+    void intersect(lf_key_size_type, const lf_run *, size_t, size_t) {}
+    void cache_hit(lf_key_size_type) {}
+    void cache_miss(lf_key_size_type) {}
+    void merge(const lf_no_stats &) {}
+    void write_json(std::ostream &out) const { out << "{}"; }
+};
+
+#if LF_STATS
+typedef lf_join_stats lf_stats_type;
+#else
+typedef lf_no_stats lf_stats_type;
+#endif
+
+#endif
@@ -1,4 +1,9 @@
 #include "leapfrog.h"
+#include "lf_optimizer.h"
+#include "lf_static_join.h"
+#include "lf_semijoin.h"
+#include "lf_dictionary.h"
+#include "leapfrog_pipelining.h"
 #include <tpie/tpie.h>
 #include <tpie/memory.h>
 #include <tpie/btree.h>
@@ -10,55 +15,19 @@
 #include <vector>
 #include <utility>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <tuple>
 #include <fstream>
+#include <iomanip>
 #include <cstdio>
+#include <functional>
+#include <chrono>
+#include <algorithm>
 using namespace std;
 
 typedef tuple<attr_type, attr_type, attr_type> triple_t;
 
-struct dictionary_t {
-    vector<string> mapping;
-    unordered_map<string, attr_type> inverted_index;
-
-    dictionary_t() {}
-    dictionary_t(dictionary_t &&dict):
-        mapping(move(dict.mapping)),
-        inverted_index(move(dict.inverted_index)) {}
-    dictionary_t(const dictionary_t &dict):
-        mapping(dict.mapping),
-        inverted_index(dict.inverted_index) {}
-
-    dictionary_t &operator=(dictionary_t &&dict) {
-        mapping = move(dict.mapping);
-        inverted_index = move(dict.inverted_index);
-        return *this;
-    }
-    dictionary_t &operator=(const dictionary_t &dict) {
-        mapping = dict.mapping;
-        inverted_index = dict.inverted_index;
-        return *this;
-    }
-
-    dictionary_t &add(const string &s) {
-        if (inverted_index.find(s) == inverted_index.end()) {
-            mapping.push_back(s);
-            inverted_index.emplace(s, mapping.size() - 1);
-        }
-        return *this;
-    }
-
-    void rebuild_inverted_index() {
-        inverted_index.clear();
-        for (vector<string>::size_type i = 0; i != mapping.size(); ++i) {
-            inverted_index.emplace(mapping[i], i);
-        }
-    }
-
-    attr_type lookup(const string &s) const {
-        return inverted_index.at(s);
-    }
-};
+typedef lf_dictionary dictionary_t;
 
 string::size_type find_matching_quote(const string& line, string::size_type p) {
     while (p < line.length()) {
@@ -72,120 +41,164 @@ string::size_type find_matching_quote(const string& line, string::size_type p) {
     return string::npos;
 }
 
-bool parse_turtle(const string &line, tuple<string, string, string> &tuple) {
-    auto p1 = line.find('<'); 
-    if (p1 == string::npos) return false;
-    auto p2 = line.find('>', p1 + 1);
-    if (p2 == string::npos) return false;
-    auto p3 = line.find('<', p2 + 1);
-    if (p3 == string::npos) return false;
-    auto p4 = line.find('>', p3 + 1);
-    if (p4 == string::npos) return false;
-    auto p5 = line.find_first_of("<\"", p4 + 1);
-    if (p5 == string::npos) return false;
-    auto p6 = (line[p5] == '<') ? line.find('>', p5 + 1) :
-        find_matching_quote(line, p5 + 1);
-    if (p6 == string::npos) return false;
-    //auto p7 = line.find('.', p6 + 1);
-    //if (p7 == string::npos || p7 + 1 != line.length()) return false;
-    tuple = make_tuple(line.substr(p1, p2 - p1 + 1),
-            line.substr(p3, p4 - p3 + 1),
-            line.substr(p5, p6 - p5 + 1));
-    return true;
+/* bytes of an input file parsed by one job at a time */
+static const size_t ingest_chunk_size = 16 << 20;
+
+/* one parse slot per job thread */
+size_t ingest_slots() {
+    return max<size_t>(tpie::default_worker_count(), 1);
+}
+
+/* writes dictionary.txt, a term per line after their number */
+bool export_dictionary(string data_dir, const dictionary_t &dict) {
+    ofstream dict_file(data_dir + "/dictionary.txt");
+    dict_file << dict.size() << '\n';
+    for (attr_type id = 0; id < dict.size(); ++id) {
+        dict_file << dict.mapping[id] << '\n';
+    }
+    return dict_file.good();
 }
 
+/* Maps dictionary.bin, or else reads dictionary.txt and writes the
+ * dictionary.bin of it for the next time. */
 bool load_dictionary(string data_dir, dictionary_t &out_dict) {
     dictionary_t dict;
-    
+
+    if (dict.open(data_dir + "/dictionary.bin")) {
+        out_dict = move(dict);
+        return true;
+    }
     cerr << "loading dictionary..." << endl;
     ifstream dict_file(data_dir + "/dictionary.txt");
     if (!dict_file.good()) return false;
     string line;
     getline(dict_file, line);
     auto dict_size = stoull(line);
-    dict.mapping.reserve(dict_size);
+    struct stat st;
+    dict.reserve(dict_size, stat((data_dir + "/dictionary.txt").c_str(), &st) ? 0 : st.st_size);
     while (getline(dict_file, line)) {
-        dict.mapping.emplace_back(move(line));
+        dict.add(line);
     }
-    dict.rebuild_inverted_index();
+    if (!dict.save(data_dir + "/dictionary.bin")) return false;
 
     out_dict = move(dict);
     return true;
 }
 
-bool create_dictionary(string data_dir, dictionary_t &out_dict) {
-    dictionary_t dict;
-    
-    cerr << "creating dictionary..." << endl;
+/* reads the paths of the files of file_list.txt */
+bool read_file_list(string data_dir, vector<string> &paths) {
     ifstream file_list(data_dir + "/file_list.txt");
     if (!file_list.good()) return false;
     string file_name;
-    string turtle;
-    tuple<string, string, string> spo;
     while (getline(file_list, file_name), !file_name.empty()) {
-        ifstream ttl_file(data_dir + "/" + file_name);
-        if (!ttl_file.good()) return false;
-        while (getline(ttl_file, turtle)) {
-            decltype(turtle.length()) p = 0;
-            while (p < turtle.length() && turtle[p] == ' ') ++p;
-            if (p == turtle.length() || turtle[p] == '#') continue;
-            if (!parse_turtle(turtle, spo)) {
-                cerr << turtle << endl;
-                return false;
-            }
-            dict.add(get<0>(spo)).add(get<1>(spo)).add(get<2>(spo));        
-        }
+        paths.push_back(data_dir + "/" + file_name);
     }
+    return true;
+}
 
-    ofstream dict_file(data_dir + "/dictionary.txt");
-    dict_file << dict.mapping.size() << endl;
-    for (const auto &s: dict.mapping) {
-        dict_file << s << endl;
+/* @returns the bytes of the files at paths */
+uint64_t input_bytes(const vector<string> &paths) {
+    uint64_t bytes = 0;
+    for (const string &path: paths) {
+        struct stat st;
+        if (!stat(path.c_str(), &st)) bytes += st.st_size;
     }
-
-    out_dict = move(dict);
-    return true;
+    return bytes;
 }
 
-bool load_or_create_dictionary(string data_dir, dictionary_t &out_dict) {
-    if (access((data_dir + "/dictionary.txt").c_str(), F_OK)) {
-        return create_dictionary(data_dir, out_dict);
-    } else {
-        return load_dictionary(data_dir, out_dict);
+/* Parses the files once, in a pipeline that gives the terms not in dict
+ * the next ids and sorts the encoded triples by predicate into
+ * sorted_by_predicate.dat. Rewrites dictionary.bin if dict grew, and
+ * dictionary.txt if there is one. */
+bool ingest_turtle(string data_dir, const vector<string> &paths, dictionary_t &dict) {
+    cerr << "encoding and sorting ..." << endl;
+    const size_t old_size = dict.size();
+    tpie::file_stream<triple_t> out;
+    out.open(data_dir + "/sorted_by_predicate.dat");
+    lf_ingest_status status;
+    auto encode = [&](const lf_term &t) -> attr_type {
+        return dict.encode(t);
+    };
+    tpie::pipelining::pipeline p = lf_ntriples_input(paths, ingest_slots(), ingest_chunk_size,
+            encode, status) | tpie::pipelining::sort() | tpie::pipelining::output(out);
+    p();
+    out.close();
+    dict.shrink_to_fit();
+    if (!status.m_ok) {
+        cerr << status.m_error << endl;
+        remove((data_dir + "/sorted_by_predicate.dat").c_str());
+        return false;
+    }
+
+    if (dict.size() != old_size) {
+        if (!dict.save(data_dir + "/dictionary.bin")) return false;
+        if (!access((data_dir + "/dictionary.txt").c_str(), F_OK)) {
+            return export_dictionary(data_dir, dict);
+        }
     }
+    return true;
 }
 
-bool read_and_sort_by_predicate(string data_dir, const dictionary_t &dict) {
-    ifstream file_list(data_dir + "/file_list.txt");
-    if (!file_list.good()) return false;
-    
-    cerr << "concatenating files ..." << endl;
+/* Writes dictionary.bin and sorted_by_predicate.dat in the memory TPIE
+ * has, whatever the number of distinct terms: the terms are sorted with
+ * their positions in the input and numbered in sorted order as they are
+ * written out, and their ids are sorted back by position into triples,
+ * which are then sorted by predicate. */
+bool ingest_turtle_external(string data_dir, const vector<string> &paths) {
+    cerr << "encoding and sorting in external memory ..." << endl;
+    lf_dictionary_writer writer(data_dir + "/dictionary.bin");
+    auto name = [&](const string &term) {
+        writer.add(term);
+    };
     tpie::file_stream<triple_t> out;
     out.open(data_dir + "/sorted_by_predicate.dat");
+    lf_ingest_status status;
+    tpie::pipelining::pipeline p = lf_ntriples_terms(paths, ingest_slots(), ingest_chunk_size, status)
+        | tpie::pipelining::serialization_sort() | lf_number_terms(name)
+        | tpie::pipelining::sort() | lf_assemble_triples()
+        | tpie::pipelining::sort() | tpie::pipelining::output(out);
+    p();
+    out.close();
+    if (!status.m_ok) {
+        cerr << status.m_error << endl;
+        remove((data_dir + "/sorted_by_predicate.dat").c_str());
+        return false;
+    }
+    return writer.finish();
+}
 
-    string ttl_file_name;
-    string turtle;
-    tuple<string, string, string> spo;
-    triple_t triple;
-    while (getline(file_list, ttl_file_name), !ttl_file_name.empty()) {
-        ifstream ttl_file(data_dir + "/" + ttl_file_name);
-        if (!ttl_file.good()) return false;
-        while (getline(ttl_file, turtle)) {
-            decltype(turtle.length()) p = 0;
-            while (p < turtle.length() && turtle[p] == ' ') ++p;
-            if (p == turtle.length() || turtle[p] == '#') continue;
-            if (!parse_turtle(turtle, spo)) return false;
-            triple = make_tuple(dict.lookup(get<1>(spo)),
-                        dict.lookup(get<0>(spo)),
-                        dict.lookup(get<2>(spo)));
-            out.write(triple);
+/* Creates the dictionary from the input files, in external memory if they
+ * are larger than the memory TPIE has or if external is set. */
+bool load_or_create_dictionary(string data_dir, bool external, dictionary_t &out_dict) {
+    if (access((data_dir + "/dictionary.bin").c_str(), F_OK)
+            && access((data_dir + "/dictionary.txt").c_str(), F_OK)) {
+        cerr << "creating dictionary..." << endl;
+        vector<string> paths;
+        if (!read_file_list(data_dir, paths)) return false;
+        if (external || input_bytes(paths) > tpie::get_memory_manager().available()) {
+            return ingest_turtle_external(data_dir, paths) && load_dictionary(data_dir, out_dict);
         }
+        return ingest_turtle(data_dir, paths, out_dict);
+    } else {
+        return load_dictionary(data_dir, out_dict);
     }
-    
-    cerr << "sorting ..." << endl;
-    tpie::sort(out, out);
+}
 
-    return true;
+/* Writes the statistics of every predicate to predicate_stats.txt, a line
+ * "predicate size" then distinct keys, max degree and sum of the squared
+ * degrees of the subjects and then of the objects. */
+bool write_predicate_stats(string data_dir, const vector<attr_type> &predicates,
+        const vector<lf_predicate_stats> &stats) {
+    ofstream stats_file(data_dir + "/predicate_stats.txt");
+    stats_file << setprecision(17);
+    for (size_t i = 0; i < predicates.size(); ++i) {
+        const lf_predicate_stats &s = stats[i];
+        stats_file << predicates[i] << ' ' << s.m_size << ' '
+            << s.m_subject.m_distinct << ' ' << s.m_subject.m_max_degree << ' '
+            << s.m_subject.m_degree_sq << ' ' << s.m_object.m_distinct << ' '
+            << s.m_object.m_max_degree << ' ' << s.m_object.m_degree_sq << '\n';
+    }
+    return stats_file.good();
 }
 
 bool create_partitioned_tables(string data_dir, const dictionary_t &dict) {
@@ -194,7 +207,22 @@ bool create_partitioned_tables(string data_dir, const dictionary_t &dict) {
     tpie::file_stream<pair<attr_type, attr_type>> out, outr;
     in.open(data_dir + "/sorted_by_predicate.dat", tpie::access_read);
     vector<attr_type> predicates;
-    
+    vector<lf_predicate_stats> stats;
+    lf_side_stats_builder subjects;
+
+    /* sorts the reversed table of the last predicate, taking the
+     * statistics of its objects on the way, and closes its tables */
+    auto close_tables = [&]() {
+        out.close();
+        tpie::sort(outr, outr);
+        outr.seek(0);
+        lf_side_stats_builder objects;
+        while (outr.can_read()) objects.push(outr.read().first);
+        stats.push_back(lf_predicate_stats{(uint64_t) outr.size(), subjects.stats(), objects.stats()});
+        outr.close();
+        subjects = lf_side_stats_builder();
+    };
+
     triple_t triple;
     if (!in.can_read()) {
         return false;
@@ -203,8 +231,9 @@ bool create_partitioned_tables(string data_dir, const dictionary_t &dict) {
     predicates.push_back(get<0>(triple));
     out.open(data_dir + "/" + to_string(predicates.back()) + ".dat", tpie::access_write);
     out.write(make_pair(get<1>(triple), get<2>(triple)));
-    outr.open(data_dir + "/" + to_string(predicates.back()) + "r.dat", tpie::access_write);
+    outr.open(data_dir + "/" + to_string(predicates.back()) + "r.dat", tpie::access_read_write);
     outr.write(make_pair(get<2>(triple), get<1>(triple)));
+    subjects.push(get<1>(triple));
     cerr << predicates.back() << " begins scan" << endl; 
 
     while (in.can_read()) {
@@ -212,20 +241,17 @@ bool create_partitioned_tables(string data_dir, const dictionary_t &dict) {
         attr_type predicate = get<0>(triple);
         if (predicate != predicates.back()) {
             cerr << predicates.back() << " ends scan" << endl; 
-            out.close();
-            tpie::sort(outr, outr);
-            outr.close();
+            close_tables();
             predicates.push_back(predicate);
             out.open(data_dir + "/" + to_string(predicates.back()) + ".dat", tpie::access_write);
-            outr.open(data_dir + "/" + to_string(predicates.back()) + "r.dat", tpie::access_write);
+            outr.open(data_dir + "/" + to_string(predicates.back()) + "r.dat", tpie::access_read_write);
             cerr << predicates.back() << " starts scan" << endl; 
         }
         out.write(make_pair(get<1>(triple), get<2>(triple)));
         outr.write(make_pair(get<2>(triple), get<1>(triple)));
+        subjects.push(get<1>(triple));
     }
-    out.close();
-    tpie::sort(outr, outr);
-    outr.close();
+    close_tables();
 
     ofstream predicate_list(data_dir  + "/predicate_list.txt");
     predicate_list << predicates.size() << endl;
@@ -233,24 +259,57 @@ bool create_partitioned_tables(string data_dir, const dictionary_t &dict) {
         predicate_list << predicate << ' ' << dict.mapping[predicate] << endl;
     }
     
-    return true;
+    return write_predicate_stats(data_dir, predicates, stats);
 }
 
-bool check_or_transform_turtle(string data_dir, const dictionary_t &dict) {
+/* scans the tables of a predicate for its statistics */
+lf_predicate_stats scan_predicate_stats(string data_dir, attr_type predicate) {
+    lf_predicate_stats stats;
+    tpie::file_stream<value_type> in;
+    in.open(data_dir + "/" + to_string(predicate) + ".dat", tpie::access_read);
+    stats.m_size = in.size();
+    stats.m_subject = lf_scan_side_stats(in);
+    in.close();
+    in.open(data_dir + "/" + to_string(predicate) + "r.dat", tpie::access_read);
+    stats.m_object = lf_scan_side_stats(in);
+    return stats;
+}
+
+/* writes predicate_stats.txt for tables made before it was, scanning them
+ * once */
+bool create_predicate_stats(string data_dir) {
+    cerr << "computing predicate statistics ..." << endl;
+    ifstream predicate_list(data_dir + "/predicate_list.txt");
+    string line;
+    getline(predicate_list, line);
+    vector<attr_type> predicates;
+    vector<lf_predicate_stats> stats;
+    while (getline(predicate_list, line), !line.empty()) {
+        predicates.push_back(stoull(line.substr(0, line.find(' '))));
+        stats.push_back(scan_predicate_stats(data_dir, predicates.back()));
+    }
+    return write_predicate_stats(data_dir, predicates, stats);
+}
+
+bool check_or_transform_turtle(string data_dir, dictionary_t &dict) {
     if (access((data_dir + "/predicate_list.txt").c_str(), F_OK)) {
         if (access((data_dir + "/sorted_by_predicate.dat").c_str(), F_OK)) {
-            if (!read_and_sort_by_predicate(data_dir, dict)) {
+            vector<string> paths;
+            if (!read_file_list(data_dir, paths) || !ingest_turtle(data_dir, paths, dict)) {
                 return false;
             }
         }
         if (!create_partitioned_tables(data_dir, dict)) {
             return false;
         }
+    } else if (access((data_dir + "/predicate_stats.txt").c_str(), F_OK)) {
+        return create_predicate_stats(data_dir);
     }
     return true;
 }
 
 void remove_files(string data_dir) {
+    remove((data_dir + "/dictionary.bin").c_str());
     remove((data_dir + "/dictionary.txt").c_str());
     remove((data_dir + "/sorted_by_predicate.dat").c_str());
     ifstream predicate_list(data_dir + "/predicate_list.txt");
@@ -263,38 +322,321 @@ void remove_files(string data_dir) {
     }
     predicate_list.close();
     remove((data_dir + "/predicate_list.txt").c_str());
+    remove((data_dir + "/predicate_stats.txt").c_str());
 }
 
 void usage(char *progname) {
-    cout  << "usage: " << progname << " [-f] <data_dir> <mem_limit (GB)>" << endl;
+    cout  << "usage: " << progname << " [-f] [-p] [-t] [-n] [-g] [-s <k> | -c <k>] [-l <k>] [-w <seconds>] [-k <seeks>] [-m <MB>] [-z] [-r] [-e] [-x] [-o <file>] <data_dir> <mem_limit (GB)>" << endl;
+    cout << "  -f  rebuild the dictionary and the tables" << endl;
+    cout << "  -p  run the join on all TPIE job threads" << endl;
+    cout << "  -t  store the tables as flat tries instead of btrees" << endl;
+    cout << "  -n  join the variables in the order of query.txt instead of" << endl;
+    cout << "      the order with the least estimated cost" << endl;
+    cout << "  -g  do not run the small queries through the static join, which" << endl;
+    cout << "      builds with LF_STATS never do" << endl;
+    cout << "  -s  only output the distinct bindings of variables 1 to k" << endl;
+    cout << "  -c  output the bindings of variables 1 to k with their number" << endl;
+    cout << "      of results" << endl;
+    cout << "  -l  stop after k results" << endl;
+    cout << "  -w  stop after the given wall-clock time" << endl;
+    cout << "  -k  stop after about the given number of seeks" << endl;
+    cout << "  -m  cache the counts of repeated subtrees in up to the given" << endl;
+    cout << "      megabytes, when counting" << endl;
+    cout << "  -z  join into a factorized representation on one thread, and" << endl;
+    cout << "      write the results out of it" << endl;
+    cout << "  -r  reduce the tables by semi-joins before building them, when" << endl;
+    cout << "      their statistics predict that it drops half their tuples" << endl;
+    cout << "  -e  build the dictionary by external sorting even if the input" << endl;
+    cout << "      files fit in memory" << endl;
+    cout << "  -x  also write the dictionary as text to dictionary.txt" << endl;
+    cout << "  -o  write the results to <file>, one per line" << endl;
+}
+
+/* an atom of query.txt; a variable 0 stands for the constant next to it */
+struct query_atom {
+    attr_type m_predicate;
+    lf_atom m_atom;
+    attr_type m_subject, m_object;
+};
+
+/* Reads the term of a query line starting at p, i.e. a variable number, an
+ * IRI or a literal, and moves p past it and the following space.
+ * @returns false if there is no such term */
+bool parse_query_term(const string &line, string::size_type &p, string &term) {
+    if (p >= line.length()) return false;
+    string::size_type end;
+    if (line[p] == '<') {
+        end = line.find('>', p + 1);
+    } else if (line[p] == '"') {
+        end = find_matching_quote(line, p + 1);
+    } else {
+        end = line.find(' ', p);
+        if (end != string::npos) --end;
+    }
+    if (end == string::npos) return false;
+    term = line.substr(p, end - p + 1);
+    p = end + 2;
+    return true;
+}
+
+/* @returns false if the constant term is not in the dictionary */
+bool resolve_query_term(const dictionary_t &dict, const string &term,
+        lf_key_size_type &var, attr_type &constant) {
+    constant = 0;
+    if (term[0] != '<' && term[0] != '"') {
+        var = (lf_key_size_type) stoull(term);
+        return true;
+    }
+    var = 0;
+    return dict.find(term, constant);
 }
 
-void run_query(string data_dir, const dictionary_t &dict) {
+/* reads the statistics of the predicate of every atom from
+ * predicate_stats.txt */
+void read_atom_stats(string data_dir, vector<query_atom> &atoms) {
+    unordered_map<attr_type, lf_predicate_stats> stats;
+    for (const auto &atom: atoms) stats.emplace(atom.m_predicate, lf_predicate_stats{});
+    ifstream stats_file(data_dir + "/predicate_stats.txt");
+    attr_type predicate;
+    lf_predicate_stats s;
+    while (stats_file >> predicate >> s.m_size
+            >> s.m_subject.m_distinct >> s.m_subject.m_max_degree >> s.m_subject.m_degree_sq
+            >> s.m_object.m_distinct >> s.m_object.m_max_degree >> s.m_object.m_degree_sq) {
+        auto it = stats.find(predicate);
+        if (it != stats.end()) it->second = s;
+    }
+    for (auto &atom: atoms) {
+        atom.m_atom.m_stats = stats[atom.m_predicate];
+    }
+}
+
+/* @returns the depth of every variable of the atoms, 0 being unused;
+ * variables 1 to nselect get the first depths. The atoms must have their
+ * statistics to be reordered. */
+vector<lf_key_size_type> choose_depths(const dictionary_t &dict,
+        const vector<query_atom> &atoms, bool reorder, lf_key_size_type nselect) {
+    lf_key_size_type nvars = 0;
+    for (const auto &atom: atoms) {
+        nvars = max({nvars, atom.m_atom.m_subject_var, atom.m_atom.m_object_var});
+    }
+    vector<lf_key_size_type> depth(nvars + 1);
+    for (lf_key_size_type var = 0; var <= nvars; ++var) {
+        depth[var] = var;
+    }
+
+    vector<bool> used(nvars + 1, false);
+    for (const auto &atom: atoms) {
+        used[atom.m_atom.m_subject_var] = used[atom.m_atom.m_object_var] = true;
+    }
+    /* the dynamic program is exponential in the number of variables */
+    if (!reorder || nvars == 0 || nvars > 16 || count(used.begin() + 1, used.end(), false)) {
+        return depth;
+    }
+
+    vector<lf_atom> stat_atoms;
+    for (const auto &atom: atoms) {
+        stat_atoms.push_back(atom.m_atom);
+    }
+    lf_plan plan = lf_optimize_order(stat_atoms, nvars, max<double>(dict.size(), 1),
+            nselect);
+
+    cerr << "variable order:";
+    for (lf_key_size_type d = 1; d <= nvars; ++d) {
+        cerr << ' ' << (unsigned) (find(plan.m_depth.begin(), plan.m_depth.end(), d) - plan.m_depth.begin());
+    }
+    cerr << endl << "estimated cost = " << plan.m_cost << endl;
+    return plan.m_depth;
+}
+
+struct query_options {
+    bool parallel = false;
+    bool reorder = true;
+    bool generic = false;
+    /* output variables 1 to nselect only, or count the results per
+     * binding of variables 1 to ngroup; 0 for neither */
+    lf_key_size_type nselect = 0;
+    lf_key_size_type ngroup = 0;
+    /* stop after limit results, seconds or seeks; 0 for no limit */
+    uint64_t limit = 0;
+    double seconds = 0;
+    uint64_t seeks = 0;
+    /* memory of the subtree caches, 0 for none */
+    size_t cache_bytes = 0;
+    /* join into an lf_factorized */
+    bool factorized = false;
+    /* reduce the inputs by semi-joins if the statistics predict it pays */
+    bool reduce = false;
+    string output_path;
+};
+
+/* Every line of query.txt is an atom "subject object predicate", where the
+ * subject and the object are variable numbers from 1, or IRIs or literals
+ * that the atom binds them to. */
+template <typename join_type>
+void run_query(string data_dir, const dictionary_t &dict, const query_options &options) {
     ifstream query(data_dir + "/query.txt");
     if (!query.good()) return ;
     
-    lf_join<tpie::btree_internal> join;
+    vector<query_atom> atoms;
     string line;
     while (getline(query, line), !line.empty()) {
-        auto p = line.find(' ');
-        auto subject_depth = stoull(line.substr(0, p));
-        auto p2 = line.find(' ', p + 1);
-        auto object_depth = stoull(line.substr(p + 1, p2 - p - 1));
-        auto predicate_str = line.substr(p2 + 1);
-        auto predicate = dict.lookup(predicate_str);
+        string::size_type p = 0;
+        string subject, object;
+        if (!parse_query_term(line, p, subject) || !parse_query_term(line, p, object)) {
+            cerr << "bad atom: " << line << endl;
+            return ;
+        }
+        query_atom atom;
+        atom.m_predicate = dict.lookup(line.substr(p));
+        atom.m_atom.m_stats = lf_predicate_stats();
+        if (!resolve_query_term(dict, subject, atom.m_atom.m_subject_var, atom.m_subject) ||
+                !resolve_query_term(dict, object, atom.m_atom.m_object_var, atom.m_object)) {
+            /* a constant that is not in the data matches nothing */
+            cout << "count = 0" << endl;
+            return ;
+        }
+        atoms.push_back(atom);
+    }
 
+    if (options.reorder || options.reduce) read_atom_stats(data_dir, atoms);
+    /* the results come in depth order; write them in variable order */
+    vector<lf_key_size_type> depth = choose_depths(dict, atoms, options.reorder,
+            max(options.nselect, options.ngroup));
+
+    /* the semi-joins keep a bitmap over the dictionary per variable and
+     * two more for the atom being scanned */
+    vector<lf_semijoin_atom> semijoin_atoms;
+    vector<lf_atom> stat_atoms;
+    for (const auto &atom: atoms) {
+        semijoin_atoms.push_back(lf_semijoin_atom{
+                data_dir + "/" + to_string(atom.m_predicate) + ".dat",
+                atom.m_atom.m_subject_var, atom.m_atom.m_object_var,
+                atom.m_subject, atom.m_object});
+        stat_atoms.push_back(atom.m_atom);
+    }
+    const lf_key_size_type nvars = (lf_key_size_type) (depth.size() - 1);
+    lf_domains domains;
+    const bool reduced = options.reduce && nvars && lf_semijoin_pays(stat_atoms, nvars) &&
+            (nvars + 3) * lf_domain::bytes(dict.size()) <=
+            tpie::get_memory_manager().available();
+    if (reduced) {
+        domains = lf_semijoin_reduce(semijoin_atoms, nvars, dict.size(),
+                atoms.size() + 1);
+    }
+    uint64_t input_size = 0, reduced_size = 0;
+
+    /* constants have depth 0 and come first, so that the join seeks the
+     * table to them once instead of filtering it */
+    typedef typename join_type::key_info_type key_info_type;
+    join_type join;
+    for (size_t i = 0; i < atoms.size(); ++i) {
+        const auto &atom = atoms[i];
+        auto predicate = atom.m_predicate;
+        lf_key_size_type subject_depth = depth[atom.m_atom.m_subject_var];
+        lf_key_size_type object_depth = depth[atom.m_atom.m_object_var];
+
+        const bool forward = subject_depth == 0 ||
+            (object_depth != 0 && subject_depth < object_depth);
         tpie::file_stream<value_type> in;
-        if (subject_depth < object_depth) {
-            in.open(data_dir + "/" + to_string(predicate) + ".dat", tpie::access_read);
-            join.load_internal_table(in, subject_depth, object_depth);
+        in.open(data_dir + "/" + to_string(predicate) + (forward ? ".dat" : "r.dat"),
+                tpie::access_read);
+        /* a temporary file with the tuples the semi-joins left */
+        tpie::file_stream<value_type> kept;
+        if (reduced) {
+            kept.open();
+            lf_semijoin_filter(in, kept, domains, semijoin_atoms[i], !forward);
+            input_size += in.size();
+            reduced_size += kept.size();
+            kept.seek(0);
+        }
+        tpie::file_stream<value_type> &table = reduced ? kept : in;
+        if (forward) {
+            join.load_internal_table(table, key_info_type{{subject_depth, object_depth}},
+                    value_type{atom.m_subject, atom.m_object});
         } else {
-            in.open(data_dir + "/" + to_string(predicate) + "r.dat", tpie::access_read);
-            join.load_internal_table(in, object_depth, subject_depth);
+            join.load_internal_table(table, key_info_type{{object_depth, subject_depth}},
+                    value_type{atom.m_object, atom.m_subject});
+        }
+    }
+    /* the tables are built; the domains take memory from the join */
+    lf_domains().swap(domains);
+    if (reduced) {
+        cerr << "semi-joins reduced " << input_size << " tuples to " << reduced_size << endl;
+    }
+    if (options.ngroup >= join.nvars()) {
+        cerr << "cannot group by every variable" << endl;
+        return ;
+    }
+    if (options.factorized && (options.nselect || options.ngroup || options.limit ||
+                options.seconds > 0 || options.seeks)) {
+        cerr << "cannot factorize with -s, -c, -l, -w or -k" << endl;
+        return ;
+    }
+    join.project(options.nselect);
+    join.group_by(options.ngroup);
+    join.limit(options.limit);
+    join.cache(options.cache_bytes);
+    lf_cancel_token token;
+    if (options.seconds > 0 || options.seeks) {
+        if (options.seconds > 0) {
+            token.set_time_budget(chrono::duration_cast<lf_cancel_token::clock::duration>(
+                        chrono::duration<double>(options.seconds)));
         }
+        token.set_seek_budget(options.seeks);
+        join.cancel_with(&token);
     }
 
-    auto count = join.join_count();
+    /* the static join keeps no statistics */
+    const bool use_static = !options.generic && !lf_stats_enabled;
+    uint64_t count;
+    if (options.factorized) {
+        lf_factorized result;
+        count = join.join_factorized(result);
+        cerr << "factorized size = " << result.size() << endl;
+        if (!options.output_path.empty()) {
+            ofstream output_file(options.output_path);
+            result.visit([&](const attr_type *tuple, size_t width) {
+                for (size_t i = 1; i <= width; ++i) {
+                    if (i > 1) output_file << ' ';
+                    output_file << dict.mapping[tuple[depth[i] - 1]];
+                }
+                output_file << '\n';
+            });
+        }
+    } else if (options.output_path.empty()) {
+        if (options.parallel) {
+            count = join.parallel_join_count();
+        } else if (!use_static || !lf_static_join_run(join, nullptr, count)) {
+            count = join.join_count();
+        }
+    } else {
+        ofstream output_file(options.output_path);
+        /* grouped results end with their count */
+        const size_t ncounts = options.ngroup ? 1 : 0;
+        lf_visitor_output<function<void(const attr_type *, size_t)>> output(
+            [&](const attr_type *tuple, size_t width) {
+                for (size_t i = 1; i + ncounts <= width; ++i) {
+                    if (i > 1) output_file << ' ';
+                    output_file << dict.mapping[tuple[depth[i] - 1]];
+                }
+                if (ncounts) output_file << ' ' << tuple[width - 1];
+                output_file << '\n';
+            });
+        if (options.parallel) {
+            count = join.parallel_join(output);
+        } else if (!use_static || !lf_static_join_run(join, &output, count)) {
+            count = join.join(output);
+        }
+    }
     cout << "count = " << count << endl;
+    if (lf_stats_enabled) {
+        cout << "stats = ";
+        join.stats().write_json(cout);
+        cout << endl;
+    }
+    if (join.stopped()) {
+        cout << "stopped, progress = " << join.progress() << endl;
+    }
 }
 
 int main(int argc, char *argv[]) {
@@ -305,9 +647,51 @@ int main(int argc, char *argv[]) {
     
     int argi = 1;
     bool force_rebuild = false;
-    if (!strcmp(argv[argi], "-f")) {
-        ++argi;
-        force_rebuild = true;
+    bool flat_trie = false;
+    bool external_ingest = false;
+    bool export_text = false;
+    query_options options;
+    for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+        if (!strcmp(argv[argi], "-f")) {
+            force_rebuild = true;
+        } else if (!strcmp(argv[argi], "-p")) {
+            options.parallel = true;
+        } else if (!strcmp(argv[argi], "-t")) {
+            flat_trie = true;
+        } else if (!strcmp(argv[argi], "-g")) {
+            options.generic = true;
+        } else if (!strcmp(argv[argi], "-n")) {
+            options.reorder = false;
+        } else if (!strcmp(argv[argi], "-s") && argi + 1 < argc) {
+            options.nselect = (lf_key_size_type) stoul(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-c") && argi + 1 < argc) {
+            options.ngroup = (lf_key_size_type) stoul(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-l") && argi + 1 < argc) {
+            options.limit = stoull(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-w") && argi + 1 < argc) {
+            options.seconds = stod(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-k") && argi + 1 < argc) {
+            options.seeks = stoull(argv[++argi]);
+        } else if (!strcmp(argv[argi], "-r")) {
+            options.reduce = true;
+        } else if (!strcmp(argv[argi], "-e")) {
+            external_ingest = true;
+        } else if (!strcmp(argv[argi], "-x")) {
+            export_text = true;
+        } else if (!strcmp(argv[argi], "-z")) {
+            options.factorized = true;
+        } else if (!strcmp(argv[argi], "-m") && argi + 1 < argc) {
+            options.cache_bytes = (size_t) stoull(argv[++argi]) * 1024 * 1024;
+        } else if (!strcmp(argv[argi], "-o") && argi + 1 < argc) {
+            options.output_path = argv[++argi];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argi == argc || (options.nselect && options.ngroup)) {
+        usage(argv[0]);
+        return 1;
     }
     const string data_dir = argv[argi++];
     if (argi == argc) {
@@ -323,24 +707,30 @@ int main(int argc, char *argv[]) {
         remove_files(data_dir);
     }
 
-    dictionary_t dict;
-    if (!load_or_create_dictionary(data_dir, dict)) {
-        cout << "[ERROR] load dictionary" << endl;
-        tpie::tpie_finish();
-        return 1;
-    }
-
-    if (!check_or_transform_turtle(data_dir, dict)) {
-        cout << "[ERROR] transform turtle" << endl;
-        tpie::tpie_finish();
-        return 1;
+    /* the dictionary takes its memory from TPIE, so it must be gone
+     * before tpie_finish() */
+    int status = 0;
+    {
+        dictionary_t dict;
+        if (!load_or_create_dictionary(data_dir, external_ingest, dict)) {
+            cout << "[ERROR] load dictionary" << endl;
+            status = 1;
+        } else if (!check_or_transform_turtle(data_dir, dict)) {
+            cout << "[ERROR] transform turtle" << endl;
+            status = 1;
+        } else if (export_text && !export_dictionary(data_dir, dict)) {
+            cout << "[ERROR] export dictionary" << endl;
+            status = 1;
+        } else if (flat_trie) {
+            run_query<lf_join<lf_flat_trie>>(data_dir, dict, options);
+        } else {
+            run_query<lf_join<tpie::btree_internal>>(data_dir, dict, options);
+        }
     }
 
-    run_query(data_dir, dict);
-
     tpie::tpie_finish();
-    cout << "<DONE>" << endl;
+    if (!status) cout << "<DONE>" << endl;
 
-    return 0;
+    return status;
 
 }
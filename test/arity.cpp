@@ -0,0 +1,25 @@
+#include "lf_test.h"
+using namespace std;
+
+typedef lf_join<lf_arity<3>, tpie::btree_internal> join_type;
+
+/* a join of three ternary relations over four variables */
+int main() {
+    lf_test_tpie tpie;
+    const attr_type nkeys = 8;
+    mt19937 rng(1);
+    vector<lf_test_table> tables{
+        lf_test_random_table(rng, {1, 2, 3}, 300, nkeys),
+        lf_test_random_table(rng, {1, 3, 4}, 300, nkeys),
+        lf_test_random_table(rng, {2, 3, 4}, 300, nkeys)};
+    const vector<lf_test_row> expected = lf_test_brute_force(tables, 4, nkeys);
+    LF_CHECK(!expected.empty());
+
+    join_type join;
+    lf_test_load(join, tables);
+    LF_CHECK(join.nvars() == 4);
+    LF_CHECK(lf_test_join(join) == expected);
+    LF_CHECK(join.join_count() == expected.size());
+    LF_CHECK(join.parallel_join_count() == expected.size());
+    return 0;
+}
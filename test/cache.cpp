@@ -0,0 +1,87 @@
+#include "lf_test.h"
+#include <functional>
+using namespace std;
+
+/* a cache of two entries drops the least recently used one */
+void check_eviction() {
+    lf_count_cache cache(2, 2);
+    const attr_type a[2] = {1, 2}, b[2] = {2, 1}, c[2] = {1, 3};
+    uint64_t n;
+    LF_CHECK(!cache.find(a, n));
+    cache.insert(a, 10);
+    cache.insert(b, 20);
+    LF_CHECK(cache.find(a, n) && n == 10);
+    cache.insert(c, 30);
+    LF_CHECK(!cache.find(b, n));
+    LF_CHECK(cache.find(a, n) && n == 10);
+    LF_CHECK(cache.find(c, n) && n == 30);
+    cache.insert(b, 40);
+    LF_CHECK(!cache.find(a, n));
+    LF_CHECK(cache.find(b, n) && n == 40);
+
+    lf_count_cache empty(2, 0);
+    empty.insert(a, 10);
+    LF_CHECK(!empty.find(a, n));
+}
+
+/* @returns the results of join grouped by its first depth, sorted */
+template <typename join_type>
+vector<lf_test_row> grouped(join_type &join, bool parallel) {
+    vector<lf_test_row> rows;
+    lf_visitor_output<function<void(const attr_type *, size_t)>> output(
+        [&](const attr_type *tuple, size_t width) {
+            rows.emplace_back(tuple, tuple + width);
+        });
+    if (parallel) {
+        join.parallel_join(output);
+    } else {
+        join.join(output);
+    }
+    sort(rows.begin(), rows.end());
+    return rows;
+}
+
+/* a 4-cycle, whose last depth only depends on depths 1 and 3, counted
+ * with caches of its subtrees too small to hold all of them */
+template <typename join_type>
+void check_cycle() {
+    const attr_type nkeys = 40;
+    mt19937 rng(1);
+    vector<lf_test_table> tables{
+        lf_test_random_table(rng, {1, 2}, 300, nkeys),
+        lf_test_random_table(rng, {2, 3}, 300, nkeys),
+        lf_test_random_table(rng, {3, 4}, 300, nkeys),
+        lf_test_random_table(rng, {1, 4}, 300, nkeys)};
+    const vector<lf_test_row> expected = lf_test_brute_force(tables, 4, nkeys);
+    LF_CHECK(!expected.empty());
+    vector<lf_test_row> groups;
+    for (const lf_test_row &row: expected) {
+        if (groups.empty() || groups.back()[0] != row[0]) groups.push_back({row[0], 0});
+        ++groups.back()[1];
+    }
+
+    join_type join;
+    lf_test_load(join, tables);
+    const uint64_t uncached = join.join_count();
+    LF_CHECK(uncached == expected.size());
+    LF_CHECK(join.parallel_join_count() == uncached);
+    /* from a few entries, which are evicted over and over, to all of them */
+    for (size_t entries: {1, 4, 64, 1 << 16}) {
+        join.cache(entries * lf_count_cache::entry_bytes(2));
+        LF_CHECK(join.join_count() == uncached);
+        LF_CHECK(join.parallel_join_count() == uncached);
+        LF_CHECK(join.parallel_join_count(16) == uncached);
+        join.group_by(1);
+        LF_CHECK(grouped(join, false) == groups);
+        LF_CHECK(grouped(join, true) == groups);
+        join.group_by(0);
+    }
+}
+
+int main() {
+    lf_test_tpie tpie;
+    check_eviction();
+    check_cycle<lf_join<tpie::btree_internal>>();
+    check_cycle<lf_join<lf_flat_trie>>();
+    return 0;
+}
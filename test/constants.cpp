@@ -0,0 +1,66 @@
+#include "lf_test.h"
+#include <functional>
+using namespace std;
+
+/* @returns a random table whose first column is bound to constant */
+lf_test_table constant_table(mt19937 &rng, lf_key_size_type depth, attr_type constant,
+        size_t nrows, attr_type nkeys) {
+    lf_test_table table = lf_test_random_table(rng, {0, depth}, nrows, nkeys);
+    table.m_constants = {constant};
+    return table;
+}
+
+/* checks the sequential and parallel joins of tables over nvars variables
+ * against trying every binding */
+template <typename join_type>
+void check(const vector<lf_test_table> &tables, size_t nvars, attr_type nkeys) {
+    const vector<lf_test_row> expected = lf_test_brute_force(tables, nvars, nkeys);
+    join_type join;
+    lf_test_load(join, tables);
+    LF_CHECK(lf_test_join(join) == expected);
+    LF_CHECK(join.join_count() == expected.size());
+    for (size_t nparts: {0, 1, 3, 16}) {
+        LF_CHECK(join.parallel_join_count(nparts) == expected.size());
+    }
+    vector<lf_test_row> results;
+    lf_visitor_output<function<void(const attr_type *, size_t)>> output(
+        [&](const attr_type *tuple, size_t width) {
+            results.emplace_back(tuple, tuple + width);
+        });
+    LF_CHECK(join.parallel_join(output) == expected.size());
+    sort(results.begin(), results.end());
+    LF_CHECK(results == expected);
+}
+
+template <typename join_type>
+void check_all() {
+    const attr_type nkeys = 16;
+    mt19937 rng(1);
+    const lf_test_table a = constant_table(rng, 1, 3, 150, nkeys),
+                        b = lf_test_random_table(rng, {1, 2}, 150, nkeys),
+                        c = constant_table(rng, 2, 5, 150, nkeys),
+                        d = constant_table(rng, 1, 7, 150, nkeys);
+    LF_CHECK(!lf_test_brute_force({a, b, c}, 2, nkeys).empty());
+    check<join_type>({a, b, c}, 2, nkeys);
+    /* a constant that no row has */
+    check<join_type>({constant_table(rng, 1, nkeys + 1, 150, nkeys), b, c}, 2, nkeys);
+    /* depth 1 only bound by tables under constants, which the ranges of
+     * the parallel join cannot be sampled from */
+    LF_CHECK(!lf_test_brute_force({a, d, c}, 2, nkeys).empty());
+    check<join_type>({a, d, c}, 2, nkeys);
+
+    /* a table of constants only, which some row matches or none does */
+    lf_test_table row = lf_test_random_table(rng, {0, 0}, 150, nkeys);
+    row.m_constants = row.m_rows.front();
+    check<join_type>({a, b, row}, 2, nkeys);
+    row.m_constants = {nkeys, 0};
+    check<join_type>({a, b, row}, 2, nkeys);
+}
+
+/* joins with tables whose leading columns are bound to constants */
+int main() {
+    lf_test_tpie tpie;
+    check_all<lf_join<tpie::btree_internal>>();
+    check_all<lf_join<lf_flat_trie>>();
+    return 0;
+}
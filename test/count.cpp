@@ -0,0 +1,73 @@
+#include "lf_test.h"
+#include <map>
+using namespace std;
+
+/* @returns the table with the key big added to every key from nkeys on,
+ * so that the keys reach up to the largest one a join binds */
+lf_test_table shifted(lf_test_table table, attr_type nkeys, attr_type big) {
+    for (lf_test_row &row: table.m_rows) {
+        for (attr_type &key: row) {
+            if (key >= nkeys) key += big;
+        }
+    }
+    return table;
+}
+
+/* @returns the number of results of a star of tables around depth 1, the
+ * product of the degrees of every key they all have */
+uint64_t star_count(const vector<lf_test_table> &tables) {
+    vector<map<attr_type, uint64_t>> degrees(tables.size());
+    for (size_t i = 0; i < tables.size(); ++i) {
+        for (const lf_test_row &row: tables[i].m_rows) ++degrees[i][row[0]];
+    }
+    uint64_t n = 0;
+    for (const auto &key: degrees[0]) {
+        uint64_t product = key.second;
+        for (size_t i = 1; i < tables.size(); ++i) {
+            auto it = degrees[i].find(key.first);
+            product *= it == degrees[i].end() ? 0 : it->second;
+        }
+        n += product;
+    }
+    return n;
+}
+
+/* a star (1, 2), (1, 3), (1, 4), whose last depth one relation binds, so
+ * that the join counts its keys without visiting them */
+template <typename join_type>
+void check_star() {
+    const attr_type nkeys = 12;
+    /* shifted keys end at the largest key that a join binds, one less than
+     * the largest key */
+    const attr_type big = ~(attr_type) 0 - 2 * nkeys;
+    mt19937 rng(1);
+    for (int i = 0; i < 3; ++i) {
+        vector<lf_test_table> tables;
+        for (lf_key_size_type leaf: {2, 3, 4}) {
+            lf_test_table table = lf_test_random_table(rng, {1, leaf}, 60, 2 * nkeys);
+            /* the first and the last keys always have rows */
+            for (attr_type key: {attr_type(0), 2 * nkeys - 1}) {
+                table.m_rows.push_back({key, 0});
+                table.m_rows.push_back({key, 2 * nkeys - 1});
+            }
+            sort(table.m_rows.begin(), table.m_rows.end());
+            table.m_rows.erase(unique(table.m_rows.begin(), table.m_rows.end()), table.m_rows.end());
+            tables.push_back(i == 0 ? table : shifted(table, nkeys, big));
+        }
+        const uint64_t expected = star_count(tables);
+        if (i == 0) LF_CHECK(expected == lf_test_brute_force(tables, 4, 2 * nkeys).size());
+        join_type join;
+        lf_test_load(join, tables);
+        LF_CHECK(join.join_count() == expected);
+        LF_CHECK(join.parallel_join_count() == expected);
+        LF_CHECK(join.parallel_join_count(5) == expected);
+        LF_CHECK(lf_test_join(join).size() == expected);
+    }
+}
+
+int main() {
+    lf_test_tpie tpie;
+    check_star<lf_join<tpie::btree_internal>>();
+    check_star<lf_join<lf_flat_trie>>();
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "lf_test.h"
+#include "lf_dictionary.h"
+#include <tpie/tempname.h>
+#include <fstream>
+#include <string>
+using namespace std;
+
+/* checks that dict numbers terms in the order they came */
+void check_terms(const lf_dictionary &dict, const vector<string> &terms) {
+    LF_CHECK(dict.size() == terms.size());
+    for (attr_type id = 0; id < terms.size(); ++id) {
+        attr_type found;
+        LF_CHECK(dict.find(terms[id], found) && found == id);
+        LF_CHECK(dict.lookup(terms[id]) == id);
+        LF_CHECK(dict.mapping[id].str() == terms[id]);
+    }
+}
+
+/* @returns n terms whose probes start at the last slot of a table of 16
+ * slots, i.e. whose hashes start with 4 bits set */
+vector<string> last_slot_terms(size_t n, const string &prefix) {
+    vector<string> terms;
+    for (size_t i = 0; terms.size() < n; ++i) {
+        string term = prefix + to_string(i);
+        if (lf_term_hash()(lf_term{term.data(), term.size()}) >> 60 == 0xf) terms.push_back(term);
+    }
+    return terms;
+}
+
+/* the dictionary in memory and mapped from its file */
+int main() {
+    lf_test_tpie tpie;
+
+    /* terms that all start probing at the last slot wrap around to the
+     * first ones, and so do the probes for terms not in the table */
+    lf_dictionary wrapped;
+    const vector<string> terms = last_slot_terms(4, "<w");
+    for (const string &term: terms) wrapped.add(term);
+    check_terms(wrapped, terms);
+    attr_type id;
+    for (const string &term: last_slot_terms(8, "<v")) {
+        LF_CHECK(!wrapped.find(term, id));
+    }
+
+    /* enough terms to rehash several times, some sharing prefixes */
+    lf_dictionary dict;
+    LF_CHECK(!dict.find(string("<x>"), id));
+    vector<string> many;
+    for (size_t i = 0; i < 20000; ++i) {
+        many.push_back(i % 3 ? "<http://x/" + to_string(i) + ">" : "\"" + to_string(i) + "\"");
+        LF_CHECK(dict.encode(many.back()) == i);
+    }
+    check_terms(dict, many);
+    for (size_t i = 0; i < many.size(); i += 7) LF_CHECK(dict.encode(many[i]) == i);
+    LF_CHECK(dict.size() == many.size());
+    LF_CHECK(!dict.find(string("<http://x/20000>"), id));
+    LF_CHECK(!dict.find(string(""), id));
+    bool thrown = false;
+    try {
+        dict.lookup("<missing>");
+    } catch (const out_of_range &) {
+        thrown = true;
+    }
+    LF_CHECK(thrown);
+
+    /* reserving first rehashes once for all of them, and leaves room */
+    lf_dictionary reserved;
+    reserved.reserve(2 * many.size(), 0);
+    for (const string &term: many) reserved.add(term);
+    check_terms(reserved, many);
+
+    /* the file maps back to the same terms, and takes a new term, which
+     * copies the mapped slots without rehashing them, even while mapped
+     * itself */
+    tpie::temp_file file;
+    LF_CHECK(reserved.save(file.path()));
+    lf_dictionary mapped;
+    LF_CHECK(mapped.open(file.path()));
+    check_terms(mapped, many);
+    LF_CHECK(mapped.encode(many[5]) == 5 && mapped.size() == many.size());
+    many.push_back("<http://y/new>");
+    LF_CHECK(mapped.encode(many.back()) == many.size() - 1);
+    check_terms(mapped, many);
+    LF_CHECK(mapped.save(file.path()));
+    check_terms(mapped, many);
+    lf_dictionary remapped;
+    LF_CHECK(remapped.open(file.path()));
+    check_terms(remapped, many);
+
+    /* an empty dictionary has a file too */
+    tpie::temp_file empty_file;
+    LF_CHECK(lf_dictionary().save(empty_file.path()));
+    lf_dictionary empty;
+    LF_CHECK(empty.open(empty_file.path()) && empty.size() == 0);
+    LF_CHECK(!empty.find(many[0], id));
+    LF_CHECK(empty.encode(many[0]) == 0 && empty.lookup(many[0]) == 0);
+
+    /* files of another version or cut short are not mapped */
+    tpie::temp_file bad;
+    {
+        ofstream out(bad.path(), ios::binary);
+        out << "LFDICT00 and then some more bytes than a header";
+    }
+    LF_CHECK(!lf_dictionary().open(bad.path()));
+    {
+        ifstream in(file.path(), ios::binary);
+        string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        ofstream out(bad.path(), ios::binary);
+        out.write(bytes.data(), bytes.size() - 1);
+    }
+    LF_CHECK(!lf_dictionary().open(bad.path()));
+    return 0;
+}
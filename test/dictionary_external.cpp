@@ -0,0 +1,85 @@
+#include "lf_test.h"
+#include "lf_dictionary.h"
+#include "leapfrog_pipelining.h"
+#include <tpie/pipelining.h>
+#include <tpie/tempname.h>
+#include <fstream>
+#include <string>
+#include <tuple>
+using namespace std;
+
+typedef tuple<attr_type, attr_type, attr_type> triple_t;
+typedef tuple<string, string, string> term_triple;
+
+/* @returns the triples of in, decoded by dict */
+vector<term_triple> decode(tpie::file_stream<triple_t> &in, const lf_dictionary &dict) {
+    vector<term_triple> triples;
+    in.seek(0);
+    while (in.can_read()) {
+        const triple_t &t = in.read();
+        triples.emplace_back(dict.mapping[get<0>(t)].str(), dict.mapping[get<1>(t)].str(),
+                dict.mapping[get<2>(t)].str());
+    }
+    sort(triples.begin(), triples.end());
+    return triples;
+}
+
+/* builds the dictionary of a small file in memory and by external sorting,
+ * which must encode the same triples */
+int main() {
+    lf_test_tpie tpie;
+    mt19937 rng(1);
+    tpie::temp_file input, dictionary;
+    {
+        ofstream out(input.path());
+        uniform_int_distribution<int> term(0, 40), predicate(0, 3);
+        for (int i = 0; i < 300; ++i) {
+            out << "<http://x/" << term(rng) << "> <p" << predicate(rng) << "> ";
+            if (i % 5 == 0) {
+                out << "\"a \\\"literal\\\" " << term(rng) << "\"@en .\n";
+            } else {
+                out << "<http://x/" << term(rng) << "> .\n";
+            }
+        }
+    }
+    const vector<string> paths{input.path()};
+
+    lf_dictionary dict;
+    tpie::file_stream<triple_t> encoded;
+    encoded.open();
+    lf_ingest_status status;
+    auto encode = [&](const lf_term &t) -> attr_type { return dict.encode(t); };
+    tpie::pipelining::pipeline p = lf_ntriples_input(paths, 2, 64, encode, status)
+        | tpie::pipelining::sort() | tpie::pipelining::output(encoded);
+    p();
+    LF_CHECK(status.m_ok);
+
+    tpie::file_stream<triple_t> external;
+    external.open();
+    {
+        lf_dictionary_writer writer(dictionary.path());
+        auto name = [&](const string &term) { writer.add(term); };
+        lf_ingest_status external_status;
+        tpie::pipelining::pipeline q = lf_ntriples_terms(paths, 2, 64, external_status)
+            | tpie::pipelining::serialization_sort() | lf_number_terms(name)
+            | tpie::pipelining::sort() | lf_assemble_triples()
+            | tpie::pipelining::sort() | tpie::pipelining::output(external);
+        q();
+        LF_CHECK(external_status.m_ok);
+        LF_CHECK(writer.finish());
+    }
+    lf_dictionary sorted;
+    LF_CHECK(sorted.open(dictionary.path()));
+
+    /* the external dictionary numbers the same terms in sorted order */
+    LF_CHECK(sorted.size() == dict.size());
+    for (attr_type id = 0; id < sorted.size(); ++id) {
+        attr_type found;
+        LF_CHECK(sorted.find(sorted.mapping[id].str(), found) && found == id);
+        LF_CHECK(dict.find(sorted.mapping[id], found));
+        if (id) LF_CHECK(sorted.mapping[id - 1].str() < sorted.mapping[id].str());
+    }
+    LF_CHECK(encoded.size() == 300 && external.size() == 300);
+    LF_CHECK(decode(encoded, dict) == decode(external, sorted));
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "lf_test.h"
+using namespace std;
+
+typedef lf_factorized::depth_list depth_list;
+
+/* checks the factor tree of the query of tables, and that the results of
+ * the factorized join are those of the join */
+template <typename join_type>
+void check(const vector<lf_test_table> &tables, size_t nvars, attr_type nkeys,
+        const vector<depth_list> &children) {
+    join_type join;
+    lf_test_load(join, tables);
+    vector<lf_test_row> expected = lf_test_join(join);
+    LF_CHECK(expected == lf_test_brute_force(tables, nvars, nkeys));
+    LF_CHECK(!expected.empty());
+
+    lf_factorized result;
+    LF_CHECK(join.join_factorized(result) == expected.size());
+    LF_CHECK(result.nvars() == nvars && result.children() == children);
+    LF_CHECK(result.count() == join.join_count());
+    vector<lf_test_row> rows;
+    result.visit([&](const attr_type *tuple, size_t width) {
+        rows.emplace_back(tuple, tuple + width);
+    });
+    sort(rows.begin(), rows.end());
+    LF_CHECK(rows == expected);
+}
+
+template <typename join_type>
+void check_all() {
+    const attr_type nkeys = 10;
+    mt19937 rng(1);
+    /* a star, whose leaves no table connects */
+    check<join_type>({
+            lf_test_random_table(rng, {1, 2}, 30, nkeys),
+            lf_test_random_table(rng, {1, 3}, 30, nkeys),
+            lf_test_random_table(rng, {1, 4}, 30, nkeys)}, 4, nkeys,
+        {{1}, {2, 3, 4}, {}, {}, {}});
+    /* a triangle with a leaf on depth 1 and one on depth 3 */
+    check<join_type>({
+            lf_test_random_table(rng, {1, 2}, 40, nkeys),
+            lf_test_random_table(rng, {2, 3}, 40, nkeys),
+            lf_test_random_table(rng, {1, 3}, 40, nkeys),
+            lf_test_random_table(rng, {1, 4}, 30, nkeys),
+            lf_test_random_table(rng, {3, 5}, 30, nkeys)}, 5, nkeys,
+        {{1}, {2, 4}, {3}, {5}, {}, {}});
+    /* two edges that share no variable */
+    check<join_type>({
+            lf_test_random_table(rng, {1, 2}, 10, nkeys),
+            lf_test_random_table(rng, {3, 4}, 10, nkeys)}, 4, nkeys,
+        {{1, 3}, {2}, {}, {4}, {}});
+
+    /* no results */
+    join_type join;
+    lf_test_load(join, {lf_test_random_table(rng, {1, 2}, 10, nkeys),
+            lf_test_random_table(rng, {1, 3}, 0, nkeys)});
+    lf_factorized result;
+    LF_CHECK(join.join_factorized(result) == 0 && result.empty() && result.count() == 0);
+}
+
+/* joins into factorized representations */
+int main() {
+    lf_test_tpie tpie;
+    check_all<lf_join<tpie::btree_internal>>();
+    check_all<lf_join<lf_flat_trie>>();
+    return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef LF_TEST_H
+#define LF_TEST_H
+
+#include "leapfrog.h"
+#include <tpie/tpie.h>
+#include <tpie/memory.h>
+#include <tpie/file_stream.h>
+#include <iostream>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Helpers of the join tests, which build small random tables, join them
+ * and compare the results with those of trying every binding of the
+ * variables. A test exits with 1 on the first check that fails.
+ */
+
+#define LF_CHECK(condition) do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #condition << std::endl; \
+            std::exit(1); \
+        } \
+    } while (0)
+
+/* TPIE, for the lifetime of a test */
+struct lf_test_tpie {
+    lf_test_tpie() {
+        tpie::tpie_init();
+        tpie::get_memory_manager().set_limit(1ull << 30);
+    }
+
+    ~lf_test_tpie() {
+        tpie::tpie_finish();
+    }
+};
+
+typedef std::vector<attr_type> lf_test_row;
+
+/* a table of a test join, its columns having increasing depths; the
+ * leading columns of depth 0 are bound to m_constants */
+struct lf_test_table {
+    std::vector<lf_key_size_type> m_depths;
+    std::vector<lf_test_row> m_rows;
+    lf_test_row m_constants;
+};
+
+/* @returns a table of about nrows rows of keys below nkeys, sorted and
+ * distinct */
+inline lf_test_table lf_test_random_table(std::mt19937 &rng, std::vector<lf_key_size_type> depths,
+        size_t nrows, attr_type nkeys) {
+    lf_test_table table;
+    table.m_depths = std::move(depths);
+    std::uniform_int_distribution<attr_type> key(0, nkeys - 1);
+    for (size_t i = 0; i < nrows; ++i) {
+        lf_test_row row;
+        for (size_t j = 0; j < table.m_depths.size(); ++j) row.push_back(key(rng));
+        table.m_rows.push_back(row);
+    }
+    std::sort(table.m_rows.begin(), table.m_rows.end());
+    table.m_rows.erase(std::unique(table.m_rows.begin(), table.m_rows.end()), table.m_rows.end());
+    return table;
+}
+
+/* adds the tables to join, through temporary streams */
+template <typename join_t>
+void lf_test_load(join_t &join, const std::vector<lf_test_table> &tables) {
+    typedef typename join_t::tuple_type tuple_type;
+    for (const lf_test_table &table: tables) {
+        tpie::file_stream<tuple_type> in;
+        in.open();
+        for (const lf_test_row &row: table.m_rows) {
+            tuple_type t;
+            for (size_t i = 0; i < join_t::arity; ++i) lf_key(t, i) = row[i];
+            in.write(t);
+        }
+        in.seek(0);
+        typename join_t::key_info_type depths;
+        std::copy(table.m_depths.begin(), table.m_depths.end(), depths.begin());
+        tuple_type constants = tuple_type();
+        for (size_t i = 0; i < table.m_constants.size(); ++i) {
+            lf_key(constants, i) = table.m_constants[i];
+        }
+        join.load_internal_table(in, depths, constants);
+    }
+}
+
+/* @returns the results of the join of tables over nvars variables, in
+ * depth order, trying every binding of them to keys below nkeys */
+inline std::vector<lf_test_row> lf_test_brute_force(const std::vector<lf_test_table> &tables,
+        size_t nvars, attr_type nkeys) {
+    std::vector<lf_test_row> results;
+    lf_test_row binding(nvars, 0);
+    for (;;) {
+        bool found = true;
+        for (const lf_test_table &table: tables) {
+            lf_test_row row;
+            for (size_t i = 0; i < table.m_depths.size(); ++i) {
+                lf_key_size_type d = table.m_depths[i];
+                row.push_back(d ? binding[d - 1] : table.m_constants[i]);
+            }
+            if (!std::binary_search(table.m_rows.begin(), table.m_rows.end(), row)) {
+                found = false;
+                break;
+            }
+        }
+        if (found) results.push_back(binding);
+        size_t i = nvars;
+        while (i > 0 && ++binding[i - 1] == nkeys) binding[--i] = 0;
+        if (i == 0) return results;
+    }
+}
+
+/* @returns the results of join, in the order it writes them */
+template <typename join_t>
+std::vector<lf_test_row> lf_test_join(join_t &join) {
+    std::vector<lf_test_row> rows;
+    join.join_visit([&](const attr_type *tuple, size_t width) {
+        rows.emplace_back(tuple, tuple + width);
+    });
+    return rows;
+}
+
+#endif
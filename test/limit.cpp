@@ -0,0 +1,65 @@
+#include "lf_test.h"
+#include <functional>
+using namespace std;
+
+typedef lf_join<tpie::btree_internal> join_type;
+
+/* @returns the results of join, in parallel if parallel, sorted then */
+vector<lf_test_row> run(join_type &join, bool parallel, uint64_t &count) {
+    vector<lf_test_row> results;
+    lf_visitor_output<function<void(const attr_type *, size_t)>> output(
+        [&](const attr_type *tuple, size_t width) {
+            results.emplace_back(tuple, tuple + width);
+        });
+    count = parallel ? join.parallel_join(output) : join.join(output);
+    if (parallel) sort(results.begin(), results.end());
+    return results;
+}
+
+/* a triangle query stopped by limits and by a cancel token */
+int main() {
+    lf_test_tpie tpie;
+    const attr_type nkeys = 32;
+    mt19937 rng(1);
+    vector<lf_test_table> tables{
+        lf_test_random_table(rng, {1, 2}, 300, nkeys),
+        lf_test_random_table(rng, {2, 3}, 300, nkeys),
+        lf_test_random_table(rng, {1, 3}, 300, nkeys)};
+    const vector<lf_test_row> expected = lf_test_brute_force(tables, 3, nkeys);
+    const uint64_t total = expected.size();
+    LF_CHECK(total > 10);
+
+    join_type join;
+    lf_test_load(join, tables);
+    uint64_t count;
+    for (uint64_t k: {uint64_t(1), uint64_t(10), total, total + 5}) {
+        join.limit(k);
+        const uint64_t n = min(k, total);
+        /* the sequential join stops after the first results */
+        vector<lf_test_row> results = run(join, false, count);
+        LF_CHECK(count == n);
+        LF_CHECK(results == vector<lf_test_row>(expected.begin(), expected.begin() + n));
+        LF_CHECK(join.stopped() == (k <= total));
+        LF_CHECK(join.join_count() == n);
+
+        results = run(join, true, count);
+        LF_CHECK(count == n && results.size() == n);
+        LF_CHECK(unique(results.begin(), results.end()) == results.end());
+        LF_CHECK(includes(expected.begin(), expected.end(), results.begin(), results.end()));
+        LF_CHECK(join.parallel_join_count() == n);
+    }
+    join.limit(0);
+
+    /* a token cancelled before the join stops it at its first poll */
+    lf_cancel_token cancelled;
+    cancelled.cancel();
+    join.cancel_with(&cancelled);
+    for (bool parallel: {false, true}) {
+        LF_CHECK(run(join, parallel, count).empty() && count == 0);
+        LF_CHECK(join.stopped() && join.progress() < 1);
+    }
+
+    join.cancel_with(nullptr);
+    LF_CHECK(join.join_count() == total && !join.stopped());
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "lf_test.h"
+#include "lf_ntriples.h"
+#include "leapfrog_pipelining.h"
+#include <tpie/pipelining.h>
+#include <tpie/tempname.h>
+#include <unordered_map>
+#include <fstream>
+#include <string>
+#include <tuple>
+using namespace std;
+
+typedef tuple<string, string, string> term_triple;
+typedef tuple<attr_type, attr_type, attr_type> triple_t;
+
+/* @returns whether the file at path parses, on 2 slots in chunks of about
+ * chunk_size bytes, into triples, in order */
+bool parse(const string &path, size_t chunk_size, vector<term_triple> &triples,
+        string &bad_line) {
+    vector<vector<term_triple>> slots(2);
+    triples.clear();
+    return lf_parse_ntriples(path, slots, chunk_size,
+        [](vector<term_triple> &slot, const lf_term &s, const lf_term &p, const lf_term &o) {
+            slot.emplace_back(s.str(), p.str(), o.str());
+        },
+        [&](vector<term_triple> &slot) {
+            triples.insert(triples.end(), slot.begin(), slot.end());
+            slot.clear();
+        }, bad_line);
+}
+
+/* checks that lf_ntriples_input pushes the triples of the file at path in
+ * order, as (predicate, subject, object), and numbers their terms in the
+ * order they first appear, as one scan of the file would */
+void check_encoding(const string &path, size_t chunk_size, const vector<term_triple> &expected) {
+    vector<string> terms;
+    unordered_map<string, attr_type> ids;
+    auto encode = [&](const lf_term &t) -> attr_type {
+        auto it = ids.emplace(t.str(), terms.size());
+        if (it.second) terms.push_back(t.str());
+        return it.first->second;
+    };
+    tpie::file_stream<triple_t> out;
+    out.open();
+    lf_ingest_status status;
+    tpie::pipelining::pipeline pipe = lf_ntriples_input(vector<string>{path}, 2, chunk_size,
+            encode, status) | tpie::pipelining::output(out);
+    pipe();
+    LF_CHECK(status.m_ok);
+
+    vector<string> first;
+    unordered_map<string, attr_type> first_ids;
+    auto number = [&](const string &term) {
+        if (first_ids.emplace(term, first.size()).second) first.push_back(term);
+        return first_ids[term];
+    };
+    LF_CHECK(out.size() == expected.size());
+    out.seek(0);
+    for (const term_triple &t: expected) {
+        attr_type s = number(get<0>(t)), p = number(get<1>(t)), o = number(get<2>(t));
+        LF_CHECK(out.read() == triple_t(p, s, o));
+    }
+    LF_CHECK(terms == first);
+}
+
+/* parses files cut into more chunks than there are slots */
+int main() {
+    lf_test_tpie tpie;
+    vector<term_triple> expected;
+    tpie::temp_file file;
+    {
+        ofstream out(file.path());
+        out << "# a comment <a> <b> <c> .\n\n";
+        for (int i = 0; i < 50; ++i) {
+            term_triple t("<http://x/" + to_string(i) + ">", "<p" + to_string(i % 3) + ">",
+                    i % 4 ? "<http://y/" + to_string(i) + ">"
+                          : "\"say \\\"" + to_string(i) + "\\\" <not an IRI>\"");
+            out << (i % 5 ? "" : "  ") << get<0>(t) << ' ' << get<1>(t) << ' ' << get<2>(t)
+                << (i % 4 ? " .\n" : "@en .\n");
+            if (i % 7 == 0) out << "   \n#<x> <y> <z> .\n";
+            expected.push_back(t);
+        }
+    }
+    vector<term_triple> triples;
+    string bad_line;
+    for (size_t chunk_size: {1, 7, 64, 1 << 20}) {
+        LF_CHECK(parse(file.path(), chunk_size, triples, bad_line));
+        LF_CHECK(triples == expected);
+        LF_CHECK(bad_line.empty());
+        check_encoding(file.path(), chunk_size, expected);
+    }
+
+    /* the first line that is not a triple is reported */
+    {
+        ofstream out(file.path(), ios::app);
+        out << "<a> <b> .\n<c> <d> <e> .\n<f> .\n";
+    }
+    for (size_t chunk_size: {1, 7, 1 << 20}) {
+        bad_line.clear();
+        LF_CHECK(!parse(file.path(), chunk_size, triples, bad_line));
+        LF_CHECK(bad_line == "<a> <b> .");
+    }
+
+    bad_line.clear();
+    LF_CHECK(!parse(file.path() + ".missing", 64, triples, bad_line) && bad_line.empty());
+    return 0;
+}
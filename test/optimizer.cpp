@@ -0,0 +1,51 @@
+#include "lf_test.h"
+#include "lf_optimizer.h"
+using namespace std;
+
+/* @returns an atom over uniform statistics, with n tuples over about
+ * distinct keys on each side */
+lf_atom atom(lf_key_size_type subject_var, lf_key_size_type object_var, uint64_t n,
+        uint64_t distinct) {
+    const double degree = (double) n / distinct;
+    lf_side_stats side{distinct, (uint64_t) degree, distinct * degree * degree};
+    return lf_atom{subject_var, object_var, lf_predicate_stats{n, side, side}};
+}
+
+/* checks that the depths are a permutation of 1 to nvars */
+void check_permutation(const lf_plan &plan, lf_key_size_type nvars) {
+    LF_CHECK(plan.m_depth.size() == size_t(nvars) + 1);
+    vector<lf_key_size_type> depths(plan.m_depth.begin() + 1, plan.m_depth.end());
+    sort(depths.begin(), depths.end());
+    for (lf_key_size_type d = 1; d <= nvars; ++d) LF_CHECK(depths[d - 1] == d);
+    LF_CHECK(plan.m_cost > 0 && plan.m_cost < numeric_limits<double>::infinity());
+}
+
+/* variable orders from fixed statistics */
+int main() {
+    const double domain = 1e6;
+    /* a path 1 - 2 - 3 - 4 whose middle atom is selective */
+    vector<lf_atom> path{atom(1, 2, 500000, 100000), atom(2, 3, 10, 10),
+        atom(3, 4, 500000, 100000)};
+    lf_plan plan = lf_optimize_order(path, 4, domain);
+    check_permutation(plan, 4);
+    LF_CHECK(max(plan.m_depth[2], plan.m_depth[3]) == 2);
+
+    /* variables 1 and 2 first, whatever the statistics */
+    plan = lf_optimize_order(path, 4, domain, 2);
+    check_permutation(plan, 4);
+    LF_CHECK(max(plan.m_depth[1], plan.m_depth[2]) == 2);
+
+    /* a triangle with an edge to a constant, which binds variable 2 to a
+     * few keys */
+    vector<lf_atom> triangle{atom(1, 2, 100000, 10000), atom(2, 3, 100000, 10000),
+        atom(1, 3, 100000, 10000), atom(0, 2, 5, 1)};
+    triangle.back().m_stats.m_object.m_distinct = 5;
+    plan = lf_optimize_order(triangle, 3, domain);
+    check_permutation(plan, 3);
+    LF_CHECK(plan.m_depth[2] == 1);
+
+    /* a single variable */
+    plan = lf_optimize_order({atom(1, 1, 100, 100)}, 1, domain);
+    check_permutation(plan, 1);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include "lf_test.h"
+#include <functional>
+using namespace std;
+
+/* a graph where key 0 has an edge to every other key, so that the range of
+ * the first depth holding it carries most of the work */
+lf_test_table skewed_edges(mt19937 &rng, vector<lf_key_size_type> depths, attr_type nkeys) {
+    lf_test_table table = lf_test_random_table(rng, depths, 8 * nkeys, nkeys);
+    for (attr_type key = 1; key < nkeys; ++key) table.m_rows.push_back({0, key});
+    sort(table.m_rows.begin(), table.m_rows.end());
+    table.m_rows.erase(unique(table.m_rows.begin(), table.m_rows.end()), table.m_rows.end());
+    return table;
+}
+
+/* checks that the parallel joins of a triangle query over skewed edges,
+ * whose workers steal ranges from one another, find the results of the
+ * sequential join */
+template <typename join_type>
+void check_triangles(const vector<lf_test_table> &tables) {
+    join_type join;
+    lf_test_load(join, tables);
+    const vector<lf_test_row> expected = lf_test_join(join);
+    LF_CHECK(!expected.empty());
+    LF_CHECK(join.join_count() == expected.size());
+    for (size_t nparts: {0, 1, 3, 64}) {
+        LF_CHECK(join.parallel_join_count(nparts) == expected.size());
+    }
+
+    vector<lf_test_row> results;
+    lf_visitor_output<function<void(const attr_type *, size_t)>> output(
+        [&](const attr_type *tuple, size_t width) {
+            results.emplace_back(tuple, tuple + width);
+        });
+    LF_CHECK(join.parallel_join(output) == expected.size());
+    sort(results.begin(), results.end());
+    LF_CHECK(results == expected);
+}
+
+int main() {
+    lf_test_tpie tpie;
+    const attr_type nkeys = 2000;
+    mt19937 rng(1);
+    vector<lf_test_table> tables{
+        skewed_edges(rng, {1, 2}, nkeys),
+        skewed_edges(rng, {2, 3}, nkeys),
+        skewed_edges(rng, {1, 3}, nkeys)};
+    check_triangles<lf_join<tpie::btree_internal>>(tables);
+    check_triangles<lf_join<lf_flat_trie>>(tables);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "lf_test.h"
+#include "leapfrog_pipelining.h"
+#include <tpie/pipelining.h>
+using namespace std;
+
+typedef lf_join<tpie::btree_internal> join_type;
+
+/* @returns the rows of N keys of the stream, from its start */
+template <size_t N>
+vector<lf_test_row> read_rows(tpie::file_stream<lf_tuple<N>> &in) {
+    vector<lf_test_row> rows;
+    in.seek(0);
+    while (in.can_read()) {
+        const lf_tuple<N> &t = in.read();
+        rows.emplace_back(t.begin(), t.end());
+    }
+    return rows;
+}
+
+/* @returns the results of join pushed through a pipeline into a stream */
+template <size_t N>
+vector<lf_test_row> pipe_join(join_type &join, bool parallel) {
+    tpie::file_stream<lf_tuple<N>> out;
+    out.open();
+    tpie::pipelining::pipeline p = lf_join_input(join, parallel) | tpie::pipelining::output(out);
+    p();
+    return read_rows(out);
+}
+
+/* a triangle query over random edges */
+int main() {
+    lf_test_tpie tpie;
+    const attr_type nkeys = 16;
+    mt19937 rng(1);
+    vector<lf_test_table> tables{
+        lf_test_random_table(rng, {1, 2}, 80, nkeys),
+        lf_test_random_table(rng, {2, 3}, 80, nkeys),
+        lf_test_random_table(rng, {1, 3}, 80, nkeys)};
+    const vector<lf_test_row> expected = lf_test_brute_force(tables, 3, nkeys);
+    LF_CHECK(!expected.empty());
+
+    join_type join;
+    lf_test_load(join, tables);
+    LF_CHECK(pipe_join<3>(join, false) == expected);
+    vector<lf_test_row> parallel = pipe_join<3>(join, true);
+    sort(parallel.begin(), parallel.end());
+    LF_CHECK(parallel == expected);
+
+    tpie::file_stream<lf_tuple<3>> out;
+    out.open();
+    lf_file_stream_output<3> output(out);
+    LF_CHECK(join.join(output) == expected.size());
+    LF_CHECK(read_rows(out) == expected);
+
+    /* the distinct bindings of the first two variables */
+    vector<lf_test_row> projected;
+    for (const lf_test_row &row: expected) {
+        lf_test_row prefix(row.begin(), row.begin() + 2);
+        if (projected.empty() || projected.back() != prefix) projected.push_back(prefix);
+    }
+    join.project(2);
+    LF_CHECK(join.output_width() == 2);
+    LF_CHECK(pipe_join<2>(join, false) == projected);
+    parallel = pipe_join<2>(join, true);
+    sort(parallel.begin(), parallel.end());
+    LF_CHECK(parallel == projected);
+
+    /* rows of two keys are not written as three */
+    bool thrown = false;
+    try {
+        join.join(output);
+    } catch (const invalid_argument &) {
+        thrown = true;
+    }
+    LF_CHECK(thrown);
+    thrown = false;
+    try {
+        pipe_join<3>(join, false);
+    } catch (const invalid_argument &) {
+        thrown = true;
+    }
+    LF_CHECK(thrown);
+
+    /* every binding of the first variable and its number of results */
+    vector<lf_test_row> grouped;
+    for (const lf_test_row &row: expected) {
+        if (grouped.empty() || grouped.back()[0] != row[0]) grouped.push_back({row[0], 0});
+        ++grouped.back()[1];
+    }
+    join.project(0);
+    join.group_by(1);
+    LF_CHECK(join.output_width() == 2);
+    LF_CHECK(pipe_join<2>(join, false) == grouped);
+    parallel = pipe_join<2>(join, true);
+    sort(parallel.begin(), parallel.end());
+    LF_CHECK(parallel == grouped);
+    return 0;
+}
@@ -0,0 +1,23 @@
+# Runs queries with constants over the triangle dataset, sequentially and
+# in parallel, and checks their counts, a constant that is not in the
+# dictionary matching nothing.
+# -DLEAPFROG=<binary> -DDATA=<dataset> -DWORK=<scratch directory>
+function(check_count query flags expected)
+    file(WRITE ${WORK}/query.txt "${query}")
+    execute_process(COMMAND ${LEAPFROG} ${flags} ${WORK} 1
+        RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_QUIET)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "leapfrog ${flags} failed: ${result}\n${output}")
+    endif()
+    if (NOT output MATCHES "count = ${expected}\n")
+        message(FATAL_ERROR "wrong count for ${flags}\n${query}expected ${expected}:\n${output}")
+    endif()
+endfunction()
+
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${DATA}/ DESTINATION ${WORK})
+foreach (flags -g -p)
+    check_count("<http://x/0> 1 <p>\n1 2 <p>\n" ${flags} 2)
+    check_count("1 2 <p>\n2 <http://x/0> <q>\n" ${flags} 2)
+    check_count("<http://x/9> 1 <p>\n1 2 <p>\n" ${flags} 0)
+endforeach()
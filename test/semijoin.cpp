@@ -0,0 +1,113 @@
+#include "lf_test.h"
+#include "lf_semijoin.h"
+#include <tpie/tempname.h>
+#include <memory>
+using namespace std;
+
+typedef lf_join<tpie::btree_internal> join_type;
+
+/* the tables of a query in files that the semi-joins scan */
+struct semijoin_query {
+    vector<lf_test_table> m_tables;
+    vector<unique_ptr<tpie::temp_file>> m_files;
+    vector<lf_semijoin_atom> m_atoms;
+
+    /* adds the atom subject_var(s, o) of object_var; 0 stands for the
+     * constant next to it */
+    void add(const lf_test_table &table, lf_key_size_type subject_var,
+            lf_key_size_type object_var, attr_type subject = 0, attr_type object = 0) {
+        m_tables.push_back(table);
+        m_files.emplace_back(new tpie::temp_file);
+        tpie::file_stream<value_type> out;
+        out.open(m_files.back()->path(), tpie::access_write);
+        for (const lf_test_row &row: table.m_rows) out.write(value_type{row[0], row[1]});
+        m_atoms.push_back(lf_semijoin_atom{m_files.back()->path(),
+                subject_var, object_var, subject, object});
+    }
+
+    /* @returns the tables with the tuples the semi-joins leave */
+    vector<lf_test_table> reduce(lf_key_size_type nvars, attr_type nkeys) const {
+        lf_domains domains = lf_semijoin_reduce(m_atoms, nvars, nkeys, m_atoms.size() + 1);
+        vector<lf_test_table> tables;
+        for (size_t i = 0; i < m_atoms.size(); ++i) {
+            tpie::file_stream<value_type> in, kept;
+            in.open(m_atoms[i].m_path, tpie::access_read);
+            kept.open();
+            lf_semijoin_filter(in, kept, domains, m_atoms[i], false);
+            kept.seek(0);
+            tables.push_back(lf_test_table{m_tables[i].m_depths, {}, {}});
+            while (kept.can_read()) {
+                const value_type &v = kept.read();
+                tables.back().m_rows.push_back({v.key1, v.key2});
+            }
+            LF_CHECK(includes(m_tables[i].m_rows.begin(), m_tables[i].m_rows.end(),
+                        tables.back().m_rows.begin(), tables.back().m_rows.end()));
+        }
+        return tables;
+    }
+};
+
+/* @returns the results of joining tables */
+vector<lf_test_row> join_tables(const vector<lf_test_table> &tables) {
+    join_type join;
+    lf_test_load(join, tables);
+    return lf_test_join(join);
+}
+
+/* @returns the number of rows of tables */
+size_t nrows(const vector<lf_test_table> &tables) {
+    size_t n = 0;
+    for (const lf_test_table &table: tables) n += table.m_rows.size();
+    return n;
+}
+
+/* semi-join reductions that must not lose any result */
+int main() {
+    lf_test_tpie tpie;
+    const attr_type nkeys = 64;
+    mt19937 rng(1);
+
+    /* an acyclic path, where most tuples dangle */
+    semijoin_query path;
+    path.add(lf_test_random_table(rng, {1, 2}, 60, nkeys), 1, 2);
+    path.add(lf_test_random_table(rng, {2, 3}, 60, nkeys), 2, 3);
+    path.add(lf_test_random_table(rng, {3, 4}, 60, nkeys), 3, 4);
+    vector<lf_test_table> reduced = path.reduce(4, nkeys);
+    LF_CHECK(nrows(reduced) < nrows(path.m_tables));
+    LF_CHECK(join_tables(reduced) == join_tables(path.m_tables));
+    LF_CHECK(!join_tables(reduced).empty());
+
+    /* a triangle */
+    semijoin_query triangle;
+    triangle.add(lf_test_random_table(rng, {1, 2}, 400, nkeys), 1, 2);
+    triangle.add(lf_test_random_table(rng, {2, 3}, 400, nkeys), 2, 3);
+    triangle.add(lf_test_random_table(rng, {1, 3}, 400, nkeys), 1, 3);
+    reduced = triangle.reduce(3, nkeys);
+    LF_CHECK(!join_tables(reduced).empty());
+    LF_CHECK(join_tables(reduced) == join_tables(triangle.m_tables));
+
+    /* an atom with a constant subject, and one over the same variable
+     * twice, which only keeps its tuples (s, s) */
+    lf_test_table loops = lf_test_random_table(rng, {1, 2}, 1000, nkeys);
+    for (attr_type key = 0; key < nkeys; key += 2) loops.m_rows.push_back({key, key});
+    sort(loops.m_rows.begin(), loops.m_rows.end());
+    loops.m_rows.erase(unique(loops.m_rows.begin(), loops.m_rows.end()), loops.m_rows.end());
+    const lf_test_table edges = lf_test_random_table(rng, {1, 2}, 300, nkeys);
+    const attr_type constant = edges.m_rows.front()[0];
+    semijoin_query loop;
+    loop.add(loops, 1, 1);
+    loop.add(edges, 0, 1, constant);
+    reduced = loop.reduce(1, nkeys);
+    LF_CHECK(!reduced[0].m_rows.empty());
+    for (const lf_test_row &row: reduced[0].m_rows) {
+        LF_CHECK(row[0] == row[1]);
+        LF_CHECK(binary_search(edges.m_rows.begin(), edges.m_rows.end(),
+                    lf_test_row{constant, row[0]}));
+    }
+    for (const lf_test_row &row: reduced[1].m_rows) {
+        LF_CHECK(row[0] == constant);
+        LF_CHECK(binary_search(loops.m_rows.begin(), loops.m_rows.end(),
+                    lf_test_row{row[1], row[1]}));
+    }
+    return 0;
+}
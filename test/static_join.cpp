@@ -0,0 +1,105 @@
+#include "lf_test.h"
+#include "lf_static_join.h"
+#include <functional>
+using namespace std;
+
+typedef vector<vector<lf_key_size_type>> shape;
+
+/* @returns random tables over the edges of a shape */
+vector<lf_test_table> random_tables(mt19937 &rng, const shape &edges, attr_type nkeys) {
+    vector<lf_test_table> tables;
+    for (const auto &edge: edges) {
+        tables.push_back(lf_test_random_table(rng, edge, 3 * nkeys, nkeys));
+    }
+    return tables;
+}
+
+/* @returns whether the static join ran, its results in rows */
+template <typename join_type>
+bool run_static(const join_type &join, uint64_t &count, vector<lf_test_row> &rows) {
+    lf_visitor_output<function<void(const attr_type *, size_t)>> output(
+        [&](const attr_type *tuple, size_t width) {
+            rows.emplace_back(tuple, tuple + width);
+        });
+    return lf_static_join_run(join, &output, count);
+}
+
+/* checks that the static join takes a query of one of its shapes and
+ * finds the results of trying every binding */
+template <typename join_type>
+void check_shape(const vector<lf_test_table> &tables, size_t nvars, attr_type nkeys) {
+    const vector<lf_test_row> expected = lf_test_brute_force(tables, nvars, nkeys);
+    LF_CHECK(!expected.empty());
+    join_type join;
+    lf_test_load(join, tables);
+    uint64_t count = 0;
+    LF_CHECK(lf_static_join_run(join, nullptr, count));
+    LF_CHECK(count == expected.size());
+    vector<lf_test_row> rows;
+    LF_CHECK(run_static(join, count, rows));
+    LF_CHECK(count == expected.size() && rows == expected);
+}
+
+/* checks that the static join turns down a query, which the generic join
+ * then runs; set(join) adds what the static join does not handle
+ * @param n the number of results the generic join finds */
+template <typename join_type, typename F>
+void check_fallback(const vector<lf_test_table> &tables, F set, uint64_t n) {
+    join_type join;
+    lf_test_load(join, tables);
+    set(join);
+    uint64_t count = 0;
+    vector<lf_test_row> rows;
+    LF_CHECK(!lf_static_join_run(join, nullptr, count));
+    LF_CHECK(!run_static(join, count, rows) && rows.empty());
+    LF_CHECK(join.join_count() == n);
+}
+
+template <typename join_type>
+void check_all() {
+    const attr_type nkeys = 12;
+    mt19937 rng(1);
+    const shape triangle{{1, 2}, {2, 3}, {1, 3}},
+                path{{1, 2}, {2, 3}, {3, 4}},
+                star{{1, 2}, {1, 3}, {1, 4}},
+                cycle{{1, 2}, {2, 3}, {3, 4}, {1, 4}};
+    check_shape<join_type>(random_tables(rng, triangle, nkeys), 3, nkeys);
+    check_shape<join_type>(random_tables(rng, path, nkeys), 4, nkeys);
+    check_shape<join_type>(random_tables(rng, star, nkeys), 4, nkeys);
+    check_shape<join_type>(random_tables(rng, cycle, nkeys), 4, nkeys);
+
+    auto none = [](join_type &) {};
+    /* two relations over the same pair of depths */
+    vector<lf_test_table> tables = random_tables(rng, {{1, 2}, {1, 2}, {2, 3}}, nkeys);
+    check_fallback<join_type>(tables, none,
+            lf_test_brute_force(tables, 3, nkeys).size());
+    /* a relation bound to a constant */
+    tables = random_tables(rng, triangle, nkeys);
+    lf_test_table constant = lf_test_random_table(rng, {0, 1}, 3 * nkeys, nkeys);
+    constant.m_constants = {constant.m_rows.front()[0]};
+    tables.push_back(constant);
+    check_fallback<join_type>(tables, none,
+            lf_test_brute_force(tables, 3, nkeys).size());
+
+    /* a limit, grouping and a cache */
+    tables = random_tables(rng, triangle, nkeys);
+    const uint64_t total = lf_test_brute_force(tables, 3, nkeys).size();
+    LF_CHECK(total > 1);
+    check_fallback<join_type>(tables, [](join_type &join) {
+        join.limit(1);
+    }, 1);
+    check_fallback<join_type>(tables, [](join_type &join) {
+        join.group_by(1);
+    }, total);
+    check_fallback<join_type>(tables, [](join_type &join) {
+        join.cache(1 << 20);
+    }, total);
+}
+
+/* the static join over the shapes it takes, and the queries it does not */
+int main() {
+    lf_test_tpie tpie;
+    check_all<lf_join<tpie::btree_internal>>();
+    check_all<lf_join<lf_flat_trie>>();
+    return 0;
+}
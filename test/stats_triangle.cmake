@@ -0,0 +1,17 @@
+# Runs a triangle query in a build with LF_STATS and checks that the join
+# counted its seeks per depth and per table.
+# -DLEAPFROG=<binary> -DDATA=<dataset> -DWORK=<scratch directory>
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${DATA}/ DESTINATION ${WORK})
+execute_process(COMMAND ${LEAPFROG} ${WORK} 1
+    RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_QUIET)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "leapfrog failed: ${result}\n${output}")
+endif()
+if (NOT output MATCHES "count = 2\n")
+    message(FATAL_ERROR "wrong count:\n${output}")
+endif()
+if (NOT output MATCHES "\"depths\": \\[{\"depth\": 1, \"seeks\": [1-9]"
+        OR NOT output MATCHES "\"tables\": \\[{\"table\": 0, \"seeks\": [1-9]")
+    message(FATAL_ERROR "no join statistics:\n${output}")
+endif()
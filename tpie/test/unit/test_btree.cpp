@@ -112,8 +112,11 @@ bool iterator_test(TA<TT...>, A && ... a) {
 		if ((i1 == e1) != (i2 == e2)) return false;
 		if (i2 == e2) break;
 		if (*i1 != *i2) return false;
+		auto prev = i1;
 		++i1;
 		++i2;
+		// Only the first value of a leaf has index 0
+		if (i2 != e2 && i1.same_leaf(prev) != (i1.index() != 0)) return false;
 	}
 	
 	while (true) {
@@ -414,6 +417,28 @@ bool bound_test(TA<TT...>, A && ... a) {
 	return true;
 }
 
+template<typename ... TT, typename ... A>
+bool finger_bound_test(TA<TT...>, A && ... a) {
+	btree<int, TT...>  tree(std::forward<A>(a)...);
+	set<int> tree2;
+
+	for (int i=0; i < 5000; ++i) {
+		int v = (i * 7919) % 10007;
+		tree.insert(v);
+		tree2.insert(v);
+	}
+
+	for (int step=1; step < 3000; step = step * 3 + 1) {
+		auto itr = tree.begin();
+		for (int k=0; k < 10100; k += step) {
+			tree.lower_bound_from(itr, k);
+			TEST_ENSURE((itr == tree.end()) == (tree2.lower_bound(k) == tree2.end()), "Finger lower bound end compare failed");
+			TEST_ENSURE(itr == tree.end() || *itr == *tree2.lower_bound(k), "Finger lower bound compare failed");
+		}
+	}
+
+	return true;
+}
 
 bool internal_basic_test() {
 	return basic_test(TA<btree_internal>());
@@ -447,6 +472,16 @@ bool internal_bound_test() {
 	return bound_test(TA<btree_internal>());
 }
 
+bool internal_finger_bound_test() {
+	return finger_bound_test(TA<btree_internal>());
+}
+
+bool internal_wide_bound_test() {
+	// Nodes this wide are searched by bisection rather than by scanning
+	return bound_test(TA<btree_internal, btree_fanout<64, 256> >())
+		&& finger_bound_test(TA<btree_internal, btree_fanout<64, 256> >());
+}
+
 bool external_basic_test() {
 	temp_file tmp;
 	return basic_test(TA<btree_external>(), tmp.path());
@@ -477,6 +512,11 @@ bool external_bound_test() {
 	return bound_test(TA<btree_external>(), tmp.path());
 }
 
+bool external_finger_bound_test() {
+	temp_file tmp;
+	return finger_bound_test(TA<btree_external>(), tmp.path());
+}
+
 bool serialized_build_test() {
     temp_file tmp;
     return build_test(TA<btree_external, btree_serialized, btree_static>(), tmp.path());
@@ -492,12 +532,15 @@ int main(int argc, char **argv) {
 		.test(internal_static_test, "internal_static")
 		.test(internal_unordered_test, "internal_unordered")
 		.test(internal_bound_test, "internal_bound")
+		.test(internal_finger_bound_test, "internal_finger_bound")
+		.test(internal_wide_bound_test, "internal_wide_bound")
 		.test(external_basic_test, "external_basic")
 		.test(external_iterator_test, "external_iterator")
 		.test(external_key_and_comparator_test, "external_key_and_compare")
 		.test(external_augment_test, "external_augment")
         .test(external_build_test, "external_build")
 		.test(external_bound_test, "external_bound")
+		.test(external_finger_bound_test, "external_finger_bound")
 		.test(serialized_build_test, "serialized_build");
 }
 
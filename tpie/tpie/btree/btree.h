@@ -26,6 +26,7 @@
 #include <tpie/memory.h>
 #include <cstddef>
 #include <vector>
+#include <algorithm>
 
 namespace tpie {
 namespace bbits {
@@ -99,6 +100,68 @@ private:
 		return m_state.store().get_child_leaf(node, i);
 	}
 
+	/**
+	 * \brief Whether nodes of the given type are searched by a linear scan
+	 *
+	 * Scanning wins when the keys of a node fit in a few cache lines.
+	 * Every key access of an external store goes through the block cache,
+	 * so those are always searched by bisection.
+	 */
+	static constexpr bool linear_search(leaf_type) {
+		return !(state_type::is_internal || state_type::is_serialized) ? false
+			: store_type::max_leaf_size() * sizeof(key_type) <= 256;
+	}
+
+	static constexpr bool linear_search(internal_type) {
+		return !(state_type::is_internal || state_type::is_serialized) ? false
+			: store_type::max_internal_size() * sizeof(key_type) <= 256;
+	}
+
+	/**
+	 * \brief Return true if a key at position key is before the bound k, that
+	 * is, "less" than k, or for an upper bound, "not greater" than k
+	 */
+	template <bool upper_bound, typename K>
+	bool before_bound(const key_type & key, const K & k) const {
+		return upper_bound ? !m_comp(k, key) : m_comp(key, k);
+	}
+
+	/**
+	 * \brief Return the first index in [lo, hi) of node n whose key is not
+	 * before the bound k, or hi if there is none
+	 */
+	template <bool upper_bound, typename N, typename K>
+	size_t search_node(N n, size_t lo, size_t hi, const K & k) const {
+		if (linear_search(n)) {
+			while (lo != hi && before_bound<upper_bound>(m_state.min_key(n, lo), k)) ++lo;
+			return lo;
+		}
+		while (lo != hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (before_bound<upper_bound>(m_state.min_key(n, mid), k))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	/**
+	 * \brief Like search_node, but faster when the result is close to lo
+	 *
+	 * Probes exponentially growing distances from lo before bisecting.
+	 */
+	template <bool upper_bound, typename N, typename K>
+	size_t gallop_node(N n, size_t lo, size_t hi, const K & k) const {
+		if (linear_search(n)) return search_node<upper_bound>(n, lo, hi, k);
+		size_t step = 1;
+		while (lo + step < hi && before_bound<upper_bound>(m_state.min_key(n, lo + step - 1), k)) {
+			lo += step;
+			step *= 2;
+		}
+		return search_node<upper_bound>(n, lo, std::min(lo + step, hi), k);
+	}
+
 	template <bool upper_bound = false, typename K>
 	leaf_type find_leaf(std::vector<internal_type> & path, K k) const {
 		path.clear();
@@ -106,16 +169,10 @@ private:
 		internal_type n = m_state.store().get_root_internal();
 		for (size_t i=2;; ++i) {
 			path.push_back(n);
-			for (size_t j=0; ; ++j) {
- 				if (j+1 == m_state.store().count(n) ||
-					(upper_bound
-					 ? m_comp(k, m_state.min_key(n, j+1))
-					 : !m_comp(m_state.min_key(n, j+1), k))) {
-					if (i == m_state.store().height()) return m_state.store().get_child_leaf(n, j);
-					n = m_state.store().get_child_internal(n, j);
-					break;
-				}
-			}
+			// The last child whose successor starts at or after the bound
+			size_t j = search_node<upper_bound>(n, 1, m_state.store().count(n), k) - 1;
+			if (i == m_state.store().height()) return m_state.store().get_child_leaf(n, j);
+			n = m_state.store().get_child_internal(n, j);
 		}
 	}
 
@@ -382,16 +439,11 @@ public:
 		std::vector<internal_type> path;
 		leaf_type l = find_leaf<true>(path, v);
 	
-		size_t i=0;
 		size_t z = m_state.store().count(l);
-		while (true) {
-			if (i == z) {
-				itr.goto_end();
-				return itr;
-			}
-			if (!m_comp(m_state.min_key(l, i), v) &&
-				!m_comp(v, m_state.min_key(l, i))) break;
-			++i;
+		size_t i = search_node<false>(l, 0, z, v);
+		if (i == z || m_comp(v, m_state.min_key(l, i))) {
+			itr.goto_end();
+			return itr;
 		}
 		itr.goto_item(path, l, i);
 		return itr;
@@ -413,16 +465,79 @@ public:
 		leaf_type l = find_leaf(path, v);
 		
 		const size_t z = m_state.store().count(l);
-		for (size_t i = 0 ; i < z ; ++i) {
-			if (!m_comp(m_state.min_key(l, i), v)) {
-				itr.goto_item(path, l, i);
-				return itr;
-			}
+		const size_t i = search_node<false>(l, 0, z, v);
+		if (i != z) {
+			itr.goto_item(path, l, i);
+			return itr;
 		}
 		itr.goto_item(path, l, z-1);
 		return ++itr;
 	}
-	
+
+	/**
+	 * \brief Move itr forward to the first element that is "not less" than
+	 * the given key
+	 *
+	 * This is a finger search: it only climbs the path stored in itr as far
+	 * as needed before descending again, so the cost is logarithmic in the
+	 * distance moved rather than in the size of the tree, and the path of
+	 * itr is reused in place.
+	 *
+	 * If the element at itr is already "not less" than v, itr is unchanged.
+	 */
+	template <typename K, typename X=enab>
+	void lower_bound_from(iterator & itr, K v, enable<X, is_ordered> =enab()) const {
+		if (m_state.store().height() == 0) return;
+
+		leaf_type l = itr.m_leaf;
+		size_t z = m_state.store().count(l);
+		if (itr.m_index == z) return; //We are at the end
+
+		// The answer is in the current leaf
+		if (!m_comp(m_state.min_key(l, z-1), v)) {
+			itr.m_index = gallop_node<false>(l, itr.m_index, z, v);
+			return;
+		}
+
+		std::vector<internal_type> & path = itr.m_path;
+		if (path.empty()) {
+			itr.m_index = z;
+			return;
+		}
+
+		// Go up until the subtree contains a key that is "not less" than v
+		size_t i = m_state.store().index(l, path.back());
+		while (path.size() > 1) {
+			internal_type n = path.back();
+			if (!m_comp(m_state.min_key(n, m_state.store().count(n)-1), v)) break;
+			path.pop_back();
+			i = m_state.store().index(n, path.back());
+		}
+
+		// And down again
+		internal_type n = path.back();
+		while (true) {
+			i = gallop_node<false>(n, i+1, m_state.store().count(n), v) - 1;
+			if (path.size() + 1 == m_state.store().height()) {
+				l = m_state.store().get_child_leaf(n, i);
+				break;
+			}
+			n = m_state.store().get_child_internal(n, i);
+			path.push_back(n);
+			i = 0;
+		}
+
+		itr.m_leaf = l;
+		z = m_state.store().count(l);
+		i = search_node<false>(l, 0, z, v);
+		if (i != z) {
+			itr.m_index = i;
+			return;
+		}
+		itr.m_index = z-1;
+		++itr;
+	}
+
 	/**
 	 * \brief Return an interator to the first element that is "greater" than
 	 * the given key
@@ -439,11 +554,10 @@ public:
 		leaf_type l = find_leaf<true>(path, v);
 		
 		const size_t z = m_state.store().count(l);
-		for (size_t i = 0 ; i < z ; ++i) {
-			if (m_comp(v, m_state.min_key(l, i))) {
-				itr.goto_item(path, l, i);
-				return itr;
-			}
+		const size_t i = search_node<true>(l, 0, z, v);
+		if (i != z) {
+			itr.goto_item(path, l, i);
+			return itr;
 		}
 		itr.goto_item(path, l, z-1);
 		return ++itr;
@@ -311,6 +311,41 @@ public:
 	
 	size_t index() const {return m_index;}
 
+	/**
+	 * \brief A position in a leaf, which unlike an iterator does not hold
+	 * the path to it and is cheap to copy
+	 */
+	struct mark {
+		leaf_type leaf;
+		size_t index;
+	};
+
+	/**
+	 * \brief Return the position of this iterator in its leaf
+	 */
+	mark get_mark() const {return mark{m_leaf, m_index};}
+
+	/**
+	 * \brief Move to a mark in the current leaf
+	 *
+	 * A leaf has a single path from the root, so the stored path stays valid.
+	 * \returns false, leaving the iterator unchanged, if m is in another leaf
+	 */
+	bool restore_mark(const mark & m) {
+		if (!(m.leaf == m_leaf)) return false;
+		m_index = m.index;
+		return true;
+	}
+
+	/**
+	 * \brief Check if this iterator is in the same leaf as o
+	 *
+	 * Moving between such iterators does not touch another node
+	 */
+	bool same_leaf(const btree_iterator & o) const {
+		return m_leaf == o.m_leaf;
+	}
+
 	btree_node<S> get_leaf() const {
 		return btree_node<S>(m_state, m_path, m_leaf);
 	}